@@ -1,14 +1,47 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
 #include <queue>
+#include <random>
+#include <span>
+#include <sstream>
 #include <stack>
-#include <valarray>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef SNAKE_INSTRUMENT
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
 constexpr int Height = 30;
 constexpr int Width = 40;
 constexpr int EmptyIdx = -1;
@@ -48,6 +81,14 @@ constexpr double PenaltyDeclineOfHeadToHeadDeath = 0.05;
 constexpr double ValueOfDeathPerRemainTime = -10;
 constexpr double ValueOfOpponentWhenHaveShield = -20;
 constexpr bool EnableSpreadableDangerAroundOpponentHead = false;
+constexpr bool EnableTerritoryAtLeaves = false;
+constexpr bool EnableTerritoryCompetitivity = false;  // decline objects an opponent owns in the territory
+constexpr bool EnableSweepDangerSolver = true;  // whole-grid sweeps instead of a queue for the danger field
+constexpr int MaxDangerSweepRounds = 16;        // before the sweeps fall back to the queue
+constexpr bool EnableSectorObjectDistances = false;  // approximate object distances through sectors, for large maps
+constexpr bool EnableSelectiveSearchDepth = false;   // extend contested lines of the search, reduce quiet ones
+constexpr double UtilityPerTerritoryCell = 0.5;
+constexpr int RootFieldThreads = 1;  // threads building the root fields; each fresh one starts with cold caches
 
 constexpr double VerySmallValue = -1e20;
 constexpr double VeryLargeValue = 1e20;
@@ -59,6 +100,329 @@ constexpr double UtilityOfOpponentShield = 5;
 constexpr double UtilityOfOpponentDeath = 40;
 constexpr double DeclinePerDepth = 0.8;  // 1.0 := no decline
 
+//
+//  Logging
+//
+
+// Levels are fixed at compile time with -DSNAKE_LOG_LEVEL=<n>; a line above it compiles to
+// nothing, and so does every dump guarded by `if constexpr (LogEnabled<...>)`.
+constexpr int LogError = 1;
+constexpr int LogInfo = 2;   // a few lines per tick: depths, nodes, cache statistics
+constexpr int LogDebug = 3;  // per tick dumps of the fields around our head
+constexpr int LogTrace = 4;  // per node dumps of the first search level
+#ifndef SNAKE_LOG_LEVEL
+#define SNAKE_LOG_LEVEL 2  // LogInfo
+#endif
+
+template <int Level>
+constexpr bool LogEnabled = Level <= SNAKE_LOG_LEVEL;
+
+constexpr size_t LogBufferBytes = 1 << 20;
+
+// Lines a thread has logged, held in a ring until Drain writes them out with a single write, so
+// logging never flushes or blocks. Appending never waits either: a full ring drops the line.
+class LogBuffer {
+    std::unique_ptr<char[]> bytes{new char[LogBufferBytes]};
+    std::atomic<size_t> appended{0};  // bytes ever appended, only moved by the owning thread
+    std::atomic<size_t> drained{0};   // bytes ever drained
+    std::atomic<long long> dropped{0};
+
+   public:
+    ~LogBuffer() { Drain(stderr); }
+
+    void Append(std::string_view text) {
+        const size_t begin = appended.load(std::memory_order_relaxed);
+        if (text.size() > LogBufferBytes - (begin - drained.load(std::memory_order_acquire))) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const size_t offset = begin % LogBufferBytes;
+        const size_t first = std::min(text.size(), LogBufferBytes - offset);
+        std::copy(text.begin(), text.begin() + first, bytes.get() + offset);
+        std::copy(text.begin() + first, text.end(), bytes.get());
+        appended.store(begin + text.size(), std::memory_order_release);
+    }
+
+    void Drain(FILE* file) {
+        const size_t begin = drained.load(std::memory_order_relaxed);
+        const size_t end = appended.load(std::memory_order_acquire);
+        const size_t offset = begin % LogBufferBytes;
+        const size_t first = std::min(end - begin, LogBufferBytes - offset);
+        fwrite(bytes.get() + offset, 1, first, file);
+        fwrite(bytes.get(), 1, end - begin - first, file);
+        drained.store(end, std::memory_order_release);
+        if (const long long lost = dropped.exchange(0, std::memory_order_relaxed)) {
+            fprintf(file, "(%lld log lines dropped)\n", lost);
+        }
+        fflush(file);
+    }
+};
+
+thread_local LogBuffer ThreadLog;
+
+// Writes out what this thread has logged; call it once the answer is out.
+void DrainLog() {
+    ThreadLog.Drain(stderr);
+}
+
+// One log line, built with << and appended to the thread's buffer at the end of the statement:
+// Log<LogInfo>() << "Depth " << depth;
+template <int Level>
+class LogLine {
+    struct Disabled {};
+    std::conditional_t<LogEnabled<Level>, std::ostringstream, Disabled> line;
+
+   public:
+    LogLine() = default;
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    ~LogLine() {
+        if constexpr (LogEnabled<Level>) {
+            if (line.view().empty() || line.view().back() != '\n') {
+                line << '\n';
+            }
+            ThreadLog.Append(line.view());
+        }
+    }
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if constexpr (LogEnabled<Level>) {
+            line << value;
+        }
+        return *this;
+    }
+
+    // For dumps spanning several lines. A disabled level hands out a stream without a buffer,
+    // which discards everything, but dumps belong under `if constexpr` and never get that far.
+    std::ostream& Stream() {
+        if constexpr (LogEnabled<Level>) {
+            return line;
+        } else {
+            static std::ostream discard(nullptr);
+            return discard;
+        }
+    }
+};
+
+template <int Level>
+LogLine<Level> Log() {
+    return {};
+}
+
+//
+//  Instrumentation
+//
+
+// Built in with -DSNAKE_INSTRUMENT, and compiled to nothing otherwise. Every operator new and
+// delete is counted against the phase its thread is in, and so are the thread's cycles, cache
+// misses and branch misses in user space where perf_event_open is allowed. Phases nest through
+// PhaseScope; hardware counters are read at every switch, one syscall each, so an instrumented
+// search runs slower and counts a little of its own bookkeeping. Counters are per thread and are
+// merged as the threads finish.
+#ifdef SNAKE_INSTRUMENT
+constexpr bool InstrumentEnabled = true;
+#else
+constexpr bool InstrumentEnabled = false;
+#endif
+
+enum class Phase { Other, Fields, Simulate, Revoke, Evaluate, Search };
+constexpr int PhaseCount = 6;
+constexpr const char* PhaseNames[PhaseCount] = {"other", "fields", "simulate", "revoke", "evaluate", "search"};
+constexpr int HardwareCounterCount = 3;
+constexpr const char* HardwareCounterNames[HardwareCounterCount] = {"cycles", "cache misses", "branch misses"};
+
+struct PhaseCounters {
+    long long Allocations, Bytes, Frees;
+    long long Hardware[HardwareCounterCount];
+};
+
+// Constant-initialized, so operator new may touch it before anything else of the thread exists.
+struct ThreadCounters {
+    Phase Current;
+    PhaseCounters Phases[PhaseCount];
+};
+
+thread_local ThreadCounters InstrumentCounters{};
+
+// A group of counters on the calling thread, opened on first use; Read() is false if the kernel
+// refused them.
+class HardwareCounters {
+    int fds[HardwareCounterCount] = {-1, -1, -1};
+    bool tried = false;
+    uint64_t last[HardwareCounterCount] = {};
+
+   public:
+    ~HardwareCounters() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool Available() {
+        if (!tried) {
+            tried = true;
+#ifdef SNAKE_INSTRUMENT
+            constexpr uint64_t configs[HardwareCounterCount] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            for (int i = 0; i < HardwareCounterCount; i++) {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+                if (fds[i] < 0) {
+                    return false;
+                }
+            }
+            Read(last);
+#endif
+        }
+        return fds[HardwareCounterCount - 1] >= 0;
+    }
+
+    void Read(uint64_t (&values)[HardwareCounterCount]) {
+        uint64_t group[1 + HardwareCounterCount];
+        if (read(fds[0], group, sizeof(group)) == sizeof(group)) {
+            std::copy(group + 1, group + 1 + HardwareCounterCount, values);
+        }
+    }
+
+    // Charges what the counters moved since the last switch to the phase being left.
+    void Charge(PhaseCounters& counters) {
+        if (!Available()) {
+            return;
+        }
+        uint64_t values[HardwareCounterCount];
+        std::copy(last, last + HardwareCounterCount, values);
+        Read(values);
+        for (int i = 0; i < HardwareCounterCount; i++) {
+            counters.Hardware[i] += values[i] - last[i];
+            last[i] = values[i];
+        }
+    }
+};
+
+thread_local HardwareCounters InstrumentHardware;
+
+void SwitchPhase(Phase phase) {
+    InstrumentHardware.Charge(InstrumentCounters.Phases[(int)InstrumentCounters.Current]);
+    InstrumentCounters.Current = phase;
+}
+
+// Puts the thread in `phase` until the end of the scope.
+class PhaseScope {
+    Phase previous;
+
+   public:
+    explicit PhaseScope(Phase phase) {
+        if constexpr (InstrumentEnabled) {
+            previous = InstrumentCounters.Current;
+            if (phase != previous) {
+                SwitchPhase(phase);
+            }
+        }
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+    ~PhaseScope() {
+        if constexpr (InstrumentEnabled) {
+            if (InstrumentCounters.Current != previous) {
+                SwitchPhase(previous);
+            }
+        }
+    }
+};
+
+// Counters of the threads that have exited, summed by MergeThreadInstrumentation.
+std::mutex InstrumentMergeMutex;
+PhaseCounters InstrumentMerged[PhaseCount];
+
+// Adds the calling thread's counters to the merged ones and clears them. Every thread that works
+// on a tick calls it before it exits, so the report covers the whole tick.
+void MergeThreadInstrumentation() {
+    if constexpr (InstrumentEnabled) {
+        SwitchPhase(InstrumentCounters.Current);
+        const std::lock_guard<std::mutex> lock(InstrumentMergeMutex);
+        for (int i = 0; i < PhaseCount; i++) {
+            PhaseCounters& counters = InstrumentCounters.Phases[i];
+            PhaseCounters& merged = InstrumentMerged[i];
+            merged.Allocations += counters.Allocations;
+            merged.Bytes += counters.Bytes;
+            merged.Frees += counters.Frees;
+            for (int k = 0; k < HardwareCounterCount; k++) {
+                merged.Hardware[k] += counters.Hardware[k];
+            }
+            counters = PhaseCounters{};
+        }
+    }
+}
+
+// Logs the counters of all threads, per phase and per search node of any thread. Hardware
+// counters of a thread the kernel refused them to are missing from the sums.
+void ReportInstrumentation(long long nodes) {
+    MergeThreadInstrumentation();
+    const double per_node = 1.0 / std::max(1LL, nodes);
+    const std::lock_guard<std::mutex> lock(InstrumentMergeMutex);
+    for (int i = 0; i < PhaseCount; i++) {
+        const PhaseCounters& counters = InstrumentMerged[i];
+        LogLine<LogInfo> line;
+        line << "Phase " << PhaseNames[i] << ": " << counters.Allocations << " allocations (" << counters.Allocations * per_node
+             << "/node), " << counters.Bytes << " bytes (" << counters.Bytes * per_node << "/node), " << counters.Frees << " frees";
+        if (InstrumentHardware.Available()) {
+            for (int k = 0; k < HardwareCounterCount; k++) {
+                line << ", " << counters.Hardware[k] << " " << HardwareCounterNames[k] << " (" << counters.Hardware[k] * per_node << "/node)";
+            }
+        }
+    }
+    if (!InstrumentHardware.Available()) {
+        Log<LogInfo>() << "Hardware counters unavailable: perf_event_open refused";
+    }
+}
+
+#ifdef SNAKE_INSTRUMENT
+// not inlined, so GCC does not pair a new it sees with the free below
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    PhaseCounters& counters = InstrumentCounters.Phases[(int)InstrumentCounters.Current];
+    counters.Allocations++;
+    counters.Bytes += size;
+    if (void* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete(void* pointer) noexcept {
+    if (pointer) {
+        InstrumentCounters.Phases[(int)InstrumentCounters.Current].Frees++;
+    }
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    operator delete(pointer);
+}
+#endif  // SNAKE_INSTRUMENT
+
 //
 //  Generic Field
 //
@@ -216,30 +580,21 @@ class Field {
         }
     }
 
-    void PrintValuesNearby(Point point, int radius) const {
+    void PrintValuesNearby(std::ostream& out, Point point, int radius) const {
         for (int h = point.h - radius; h <= point.h + radius; h++) {
             for (int w = point.w - radius; w <= point.w + radius; w++) {
-                if (h == point.h && w == point.w) {
-                    std::cerr << "[";
-                } else {
-                    std::cerr << " ";
-                }
+                out << (h == point.h && w == point.w ? "[" : " ");
                 if (h < 0 || h >= Height || w < 0 || w >= Width) {
-                    fprintf(stderr, "   X  ");
+                    out << "   X  ";
                 } else {
+                    char text[32];
                     double value = (*this)[h][w];
-                    if (std::abs(value) >= 10000)
-                        fprintf(stderr, "%-6.1g", value);
-                    else
-                        fprintf(stderr, "%-6.1f", value);
-                }
-                if (h == point.h && w == point.w) {
-                    std::cerr << "]";
-                } else {
-                    std::cerr << " ";
+                    snprintf(text, sizeof(text), std::abs(value) >= 10000 ? "%-6.1g" : "%-6.1f", value);
+                    out << text;
                 }
+                out << (h == point.h && w == point.w ? "]" : " ");
             }
-            std::cerr << std::endl;
+            out << '\n';
         }
     }
 };
@@ -355,16 +710,58 @@ struct Cell {
     ObjType Obj;
 };
 
-class NoTimeRemainException : public std::exception {};
+// Flat, pointer-free copy of a position. Cells take 2 bytes and bodies live in one shared
+// pool of cell indices, so a snapshot is ~8 KB and can be memcpy'd between threads or caches.
+constexpr int MaxSnapshotSnakeCount = 32;
+constexpr int MaxSnapshotBodyCells = 2 * Height * Width;  // dead bodies may overlap live ones
+constexpr uint8_t SnapshotEmptyIdx = 0xFF;
+
+struct GameSnapshot {
+    struct PackedCell {
+        uint8_t Obj;
+        uint8_t SnakeIdx;  // SnapshotEmptyIdx: Empty
+    };
+    struct PackedSnake {
+        int32_t Name;
+        int32_t Score;
+        int16_t ShieldCD;
+        int16_t ShieldET;
+        int8_t LastOperation;
+        uint8_t Alive;
+        uint16_t BodyBegin;  // offset into BodyCells, head first
+        uint16_t BodyLength;
+    };
+
+    int16_t TimeRemain;
+    int16_t SelfIdx;
+    uint16_t SnakeCnt;
+    uint16_t BodyCellCnt;
+    PackedSnake Snakes[MaxSnapshotSnakeCount];
+    PackedCell Map[Height][Width];
+    uint16_t BodyCells[MaxSnapshotBodyCells];
+};
+static_assert(std::is_trivially_copyable_v<GameSnapshot>);
+
+// splitmix64 finalizer, used to build position hashes without a Zobrist table
+uint64_t Mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
 
 struct Game {
     int TimeRemain;
     int SelfIdx;
     std::vector<SnakeInfo> SnakeInfos;
     Cell Map[Height][Width];
+    uint64_t MapHash;  // XOR of CellHash over the map, kept up to date by imagining and revoking
 
-    Game() {
-        std::cin >> TimeRemain;
+    Game() : Game(std::cin) {}
+
+    explicit Game(std::istream& input) {
+        SelfIdx = EmptyIdx;
+        input >> TimeRemain;
 
         for (int h = 0; h < Height; h++) {
             for (int w = 0; w < Width; w++) {
@@ -373,10 +770,10 @@ struct Game {
         }
 
         int obj_cnt;
-        std::cin >> obj_cnt;
+        input >> obj_cnt;
         for (int i = 0; i < obj_cnt; i++) {
             int h, w, type_idx;
-            std::cin >> h >> w >> type_idx;
+            input >> h >> w >> type_idx;
             if (h < 0 || h >= Height || w < 0 || w >= Width) {
                 continue;
             }
@@ -402,11 +799,11 @@ struct Game {
         }
 
         int snake_cnt;
-        std::cin >> snake_cnt;
+        input >> snake_cnt;
         SnakeInfos.resize(snake_cnt);
         for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
             int name, length, score, operation, shield_cd, shield_et;
-            std::cin >> name >> length >> score >> operation >> shield_cd >> shield_et;
+            input >> name >> length >> score >> operation >> shield_cd >> shield_et;
             if (name == SelfName) {
                 SelfIdx = snake_idx;
             }
@@ -421,7 +818,7 @@ struct Game {
             };
             for (int i = 0; i < length; i++) {
                 int h, w;
-                std::cin >> h >> w;
+                input >> h >> w;
                 if (h < 0)
                     h = 0;
                 if (h >= Height)
@@ -434,6 +831,109 @@ struct Game {
                 Map[h][w].SnakeIdx = snake_idx;
             }
         }
+        RehashMap();
+    }
+
+    explicit Game(const GameSnapshot& snapshot) {
+        TimeRemain = snapshot.TimeRemain;
+        SelfIdx = snapshot.SelfIdx;
+        for (int h = 0; h < Height; h++) {
+            for (int w = 0; w < Width; w++) {
+                const GameSnapshot::PackedCell& cell = snapshot.Map[h][w];
+                Map[h][w] = Cell{
+                    .SnakeIdx = cell.SnakeIdx == SnapshotEmptyIdx ? EmptyIdx : cell.SnakeIdx,
+                    .Obj = (ObjType)cell.Obj,
+                };
+            }
+        }
+        SnakeInfos.resize(snapshot.SnakeCnt);
+        for (int snake_idx = 0; snake_idx < snapshot.SnakeCnt; snake_idx++) {
+            const GameSnapshot::PackedSnake& snake = snapshot.Snakes[snake_idx];
+            SnakeInfos[snake_idx] = SnakeInfo{
+                .Idx = snake_idx,
+                .Alive = snake.Alive != 0,
+                .Name = snake.Name,
+                .Score = snake.Score,
+                .LastOperation = (Operation)snake.LastOperation,
+                .ShieldCD = snake.ShieldCD,
+                .ShieldET = snake.ShieldET,
+            };
+            for (int i = 0; i < snake.BodyLength; i++) {
+                const int cell_idx = snapshot.BodyCells[snake.BodyBegin + i];
+                SnakeInfos[snake_idx].Body.push_back(Point{.h = cell_idx / Width, .w = cell_idx % Width});
+            }
+        }
+        RehashMap();
+    }
+
+    // Returns false (leaving `snapshot` unspecified) if the position exceeds the snapshot capacity.
+    bool Snapshot(GameSnapshot& snapshot) const {
+        if (SnakeInfos.size() > MaxSnapshotSnakeCount) {
+            return false;
+        }
+        snapshot.TimeRemain = TimeRemain;
+        snapshot.SelfIdx = SelfIdx;
+        snapshot.SnakeCnt = SnakeInfos.size();
+        for (int h = 0; h < Height; h++) {
+            for (int w = 0; w < Width; w++) {
+                snapshot.Map[h][w] = GameSnapshot::PackedCell{
+                    .Obj = (uint8_t)Map[h][w].Obj,
+                    .SnakeIdx = Map[h][w].SnakeIdx == EmptyIdx ? SnapshotEmptyIdx : (uint8_t)Map[h][w].SnakeIdx,
+                };
+            }
+        }
+        int body_cell_cnt = 0;
+        for (int snake_idx = 0; snake_idx < (int)SnakeInfos.size(); snake_idx++) {
+            const SnakeInfo& snake = SnakeInfos[snake_idx];
+            if (body_cell_cnt + snake.Body.size() > MaxSnapshotBodyCells) {
+                return false;
+            }
+            snapshot.Snakes[snake_idx] = GameSnapshot::PackedSnake{
+                .Name = snake.Name,
+                .Score = snake.Score,
+                .ShieldCD = (int16_t)snake.ShieldCD,
+                .ShieldET = (int16_t)snake.ShieldET,
+                .LastOperation = (int8_t)snake.LastOperation,
+                .Alive = snake.Alive,
+                .BodyBegin = (uint16_t)body_cell_cnt,
+                .BodyLength = (uint16_t)snake.Body.size(),
+            };
+            for (const Point& point : snake.Body) {
+                snapshot.BodyCells[body_cell_cnt++] = point.h * Width + point.w;
+            }
+        }
+        snapshot.BodyCellCnt = body_cell_cnt;
+        return true;
+    }
+
+    static uint64_t CellHash(int h, int w, Cell cell) {
+        if (cell.SnakeIdx == EmptyIdx && cell.Obj == None) {
+            return 0;
+        }
+        return Mix64(((uint64_t)(h * Width + w) << 16) | ((cell.SnakeIdx + 1) << 8) | cell.Obj);
+    }
+
+    void RehashMap() {
+        MapHash = 0;
+        for (int h = 0; h < Height; h++) {
+            for (int w = 0; w < Width; w++) {
+                MapHash ^= CellHash(h, w, Map[h][w]);
+            }
+        }
+    }
+
+    // Hash of everything that decides the rest of the game: cells, snake states, body order and time.
+    uint64_t PositionHash() const {
+        uint64_t hash = Mix64(TimeRemain) ^ MapHash;
+        for (const SnakeInfo& snake : SnakeInfos) {
+            uint64_t snake_hash = Mix64(((uint64_t)snake.Idx << 40) | ((uint64_t)snake.Alive << 32) | (uint32_t)snake.Score);
+            snake_hash = Mix64(snake_hash ^ ((snake.LastOperation + 1) | (snake.ShieldCD << 8) | (snake.ShieldET << 20)));
+            for (const Point& point : snake.Body) {
+                snake_hash = Mix64(snake_hash ^ (point.h * Width + point.w));
+            }
+            hash ^= snake_hash;
+        }
+        return hash;
     }
 
     bool CanOperate(int SnakeIdx, Operation operation) {
@@ -470,52 +970,76 @@ struct Game {
         return true;
     }
 
-    void PrintMapNearby(Point point, int radius) const {
+    // Whether `operation` kills the snake in ImagineOperations whatever the others do: leaving the
+    // map, hitting a wall, shielding on cooldown, or entering another snake's body off its tail.
+    bool IsCertainDeath(int SnakeIdx, Operation operation) const {
+        const SnakeInfo& snake = SnakeInfos[SnakeIdx];
+        if (operation == Operation::Shield) {
+            return snake.ShieldCD > 0;
+        }
+        const int head_h_next = snake.Body.front().h + DhOfOperation(operation);
+        const int head_w_next = snake.Body.front().w + DwOfOperation(operation);
+        if (head_h_next < 0 || head_h_next >= Height || head_w_next < 0 || head_w_next >= Width) {
+            return true;
+        }
+        const Cell& cell = Map[head_h_next][head_w_next];
+        if (cell.Obj == Wall) {
+            return true;
+        }
+        // the shield still holds after this tick's decrement
+        if (cell.SnakeIdx == EmptyIdx || cell.SnakeIdx == SnakeIdx || snake.ShieldET > 1) {
+            return false;
+        }
+        const Point& tail = SnakeInfos[cell.SnakeIdx].Body.back();
+        return tail.h != head_h_next || tail.w != head_w_next;
+    }
+
+    void PrintMapNearby(std::ostream& out, Point point, int radius) const {
         for (int h = point.h - radius; h <= point.h + radius; h++) {
             for (int w = point.w - radius; w <= point.w + radius; w++) {
                 if (h == point.h && w == point.w) {
-                    std::cerr << "[";
+                    out << "[";
                 } else {
-                    std::cerr << " ";
+                    out << " ";
                 }
                 if (h < 0 || h >= Height || w < 0 || w >= Width) {
-                    std::cerr << "X";
+                    out << "X";
                 } else {
                     if (Map[h][w].SnakeIdx == EmptyIdx) {
                         switch (Map[h][w].Obj) {
                             case None:
-                                std::cerr << ".";
+                                out << ".";
                                 break;
                             case Length:
-                                std::cerr << "L";
+                                out << "L";
                                 break;
                             case Trap:
-                                std::cerr << "T";
+                                out << "T";
                                 break;
                             case Wall:
-                                std::cerr << "W";
+                                out << "W";
                                 break;
                             default:
-                                std::cerr << Map[h][w].Obj - ScoreZero;
+                                out << Map[h][w].Obj - ScoreZero;
                                 break;
                         }
                     } else if (Map[h][w].SnakeIdx == SelfIdx) {
-                        std::cerr << "S";
+                        out << "S";
                     } else {
                         if (SnakeInfos[Map[h][w].SnakeIdx].Body.front().h == h && SnakeInfos[Map[h][w].SnakeIdx].Body.front().w == w) {
-                            std::cerr << "O";
+                            out << "O";
                         } else {
-                            std::cerr << "o";
+                            out << "o";
                         }
                     }
                 }
                 if (h == point.h && w == point.w) {
-                    std::cerr << "]";
+                    out << "]";
                 } else {
-                    std::cerr << " ";
+                    out << " ";
                 }
             }
-            std::cerr << std::endl;
+            out << '\n';
         }
     }
 
@@ -549,178 +1073,189 @@ struct Game {
 
         std::vector<SnakeInfoRevokeEntry> SnakeInfoRevokeList;
         std::vector<MapRevokeEntry> MapRevokeList;
+        uint64_t MapHash;
+        int TimeRemain;
     };
 
     std::stack<RevokeEntry> RevokeStack;
 
-   public:
-    void ImagineTailLengthen(int snake_idx, RevokeEntry& r_entry, std::vector<int>& snake_revoke_entry_idxs) {
-        const int tail_h = SnakeInfos[snake_idx].Body.back().h;
-        const int tail_w = SnakeInfos[snake_idx].Body.back().w;
-        const int pre_tail_h = (++SnakeInfos[snake_idx].Body.rbegin())->h;
-        const int pre_tail_w = (++SnakeInfos[snake_idx].Body.rbegin())->w;
-        Operation direction = Invalid;
-        for (auto i : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-            if (pre_tail_h + DhOfOperation(i) == tail_h && pre_tail_w + DwOfOperation(i) == tail_w) {
-                direction = i;
-                break;
-            }
+    // Moving snakes by the cell their head is on, so that every body on the board is walked once
+    // per tick instead of once per moving snake. Empty between ImagineOperations calls.
+    struct HeadBuckets {
+        int First[Height][Width];
+        std::vector<int> Next;  // by snake index
+
+        HeadBuckets() { std::fill(&First[0][0], &First[0][0] + Height * Width, EmptyIdx); }
+    };
+    HeadBuckets head_buckets;
+    std::vector<std::pair<int, int>> collision_hits;  // (snake, snake whose body its head is in)
+    uint32_t map_write_stamps[Height][Width] = {};
+    uint32_t map_write_stamp = 0;
+
+    // Every map write of a tick is preceded by a revoke entry holding the cell before it, so the
+    // cells a tick changed go from the Last of their first entry to what the map holds now.
+    void UpdateMapHash(RevokeEntry& r_entry) {
+        r_entry.MapHash = MapHash;
+        if (++map_write_stamp == 0) {
+            std::fill(&map_write_stamps[0][0], &map_write_stamps[0][0] + Height * Width, 0);
+            map_write_stamp = 1;
         }
-        if (direction == Operation::Right) {
-            if (tail_w == 39) {
-                if (tail_h == 29)
-                    direction = Operation::Up;
-                else
-                    direction = Operation::Down;
-            } else {
-                direction = Operation::Right;
-            }
-        } else if (direction == Operation::Down) {
-            if (tail_h == 29) {
-                if (tail_w == 39)
-                    direction = Operation::Left;
-                else
-                    direction = Operation::Right;
-            } else {
-                direction = Operation::Down;
+        for (const auto& item : r_entry.MapRevokeList) {
+            if (map_write_stamps[item.H][item.W] != map_write_stamp) {
+                map_write_stamps[item.H][item.W] = map_write_stamp;
+                MapHash ^= CellHash(item.H, item.W, item.Last) ^ CellHash(item.H, item.W, Map[item.H][item.W]);
             }
-        } else if (direction == Operation::Left) {
-            if (tail_w == 0) {
-                if (tail_h == 29)
-                    direction = Operation::Up;
-                else
-                    direction = Operation::Down;
-            } else {
-                direction = Operation::Left;
+        }
+    }
+
+    // A snake without shield dies with its head inside another snake's body, and a head-on kills
+    // both. Deaths happen in the order of checking every moving snake against every other one.
+    template <bool ShieldRules>
+    void ImagineCollisions(std::span<const SnakeIdxAndOperation> operations, RevokeEntry& r_entry) {
+        head_buckets.Next.resize(SnakeInfos.size());
+        for (const auto& op : operations) {
+            const SnakeInfo& snake = SnakeInfos[op.Idx];
+            if (snake.Alive && (!ShieldRules || snake.ShieldET <= 0)) {
+                int& first = head_buckets.First[snake.Body.front().h][snake.Body.front().w];
+                head_buckets.Next[op.Idx] = first;
+                first = op.Idx;
             }
-        } else {
-            if (tail_h == 0) {
-                if (tail_w == 39)
-                    direction = Operation::Left;
-                else
-                    direction = Operation::Right;
-            } else {
-                direction = Operation::Up;
+        }
+        collision_hits.clear();
+        for (const SnakeInfo& other_snake : SnakeInfos) {
+            for (const Point& point : other_snake.Body) {
+                for (int idx = head_buckets.First[point.h][point.w]; idx != EmptyIdx; idx = head_buckets.Next[idx]) {
+                    if (idx != other_snake.Idx) {
+                        collision_hits.push_back({idx, other_snake.Idx});
+                    }
+                }
             }
         }
-        const int next_h = tail_h + DhOfOperation(direction);
-        const int next_w = tail_w + DwOfOperation(direction);
-        r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
-            .H = next_h,
-            .W = next_w,
-            .Last = Map[next_h][next_w],
-        });
-        r_entry.SnakeInfoRevokeList[snake_revoke_entry_idxs[snake_idx]].BodyRevokeList.push_back(RevokeEntry::BodyRevokeAction{
-            .Op = RevokeEntry::ListOperation::PopBack,
-        });
-        Map[next_h][next_w].SnakeIdx = snake_idx;
-        SnakeInfos[snake_idx].Body.push_back(Point{.h = next_h, .w = next_w});
-    }
+        for (const auto& op : operations) {
+            head_buckets.First[SnakeInfos[op.Idx].Body.front().h][SnakeInfos[op.Idx].Body.front().w] = EmptyIdx;
+        }
+        if (collision_hits.empty()) {
+            return;
+        }
 
-    void ImagineDeath(int snake_idx, RevokeEntry& r_entry) {
-        int s_score = SnakeInfos[snake_idx].Score;
-        for (const auto& point : SnakeInfos[snake_idx].Body) {
-            r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
-                .H = point.h,
-                .W = point.w,
-                .Last = Map[point.h][point.w],
-            });
-            Map[point.h][point.w] = {.SnakeIdx = EmptyIdx, .Obj = None};
-            if (s_score <= 0) {
-                break;
+        std::sort(collision_hits.begin(), collision_hits.end());
+        collision_hits.erase(std::unique(collision_hits.begin(), collision_hits.end()), collision_hits.end());
+        auto hit = collision_hits.begin();
+        for (const auto& op : operations) {
+            while (hit != collision_hits.end() && hit->first < op.Idx) {
+                hit++;
             }
-            if (Map[point.h][point.w].Obj != None) {
+            if (!SnakeInfos[op.Idx].Alive || (ShieldRules && SnakeInfos[op.Idx].ShieldET > 0)) {
                 continue;
             }
-            if (s_score >= 20) {
-                Map[point.h][point.w].Obj = ScoreTwenty;
-                s_score -= 20;
-            } else {
-                Map[point.h][point.w].Obj = (ObjType)(ScoreZero + s_score);
-                s_score = 0;
+            const Point head = SnakeInfos[op.Idx].Body.front();
+            for (; hit != collision_hits.end() && hit->first == op.Idx; hit++) {
+                const Point other_head = SnakeInfos[hit->second].Body.front();
+                if (other_head.h == head.h && other_head.w == head.w) {
+                    ImagineDeath(hit->second, r_entry);
+                }
+                ImagineDeath(op.Idx, r_entry);
             }
         }
-        SnakeInfos[snake_idx].Alive = false;
-        // SnakeInfos[snake_idx].Body.clear();
     }
 
-    void ImagineOperations(std::vector<SnakeIdxAndOperation> operations, bool lucky_tail_for_other_snake) {
+    // The rules of a tick, applied in three passes over the snakes: shields, moves, then what the
+    // heads land on. ShieldRules may only be false if no operation is a shield and no moving snake
+    // has a shield in effect. The shield pass is then nothing but saving each snake, so it folds
+    // into the move pass, as a move changes no other snake's info, and no head is shielded from
+    // collisions. GrowthRule may only be false if no tail grows for luck this tick. The landing
+    // pass stays apart, since a later snake vacating its tail clears what an earlier head is on.
+    template <bool ShieldRules, bool GrowthRule>
+    void ImagineOperationsWith(std::span<const SnakeIdxAndOperation> operations, bool lucky_tail_for_other_snake) {
         RevokeEntry r_entry;
-        TimeRemain--;
-        std::sort(operations.begin(), operations.end(), [](const SnakeIdxAndOperation& a, const SnakeIdxAndOperation& b) {
-            return a.Idx < b.Idx;
-        });
-        std::vector<int> snake_revoke_entry_idxs(SnakeInfos.size(), -1);
-        for (const auto& op : operations) {
-            SnakeInfo& snake = SnakeInfos[op.Idx];
+        r_entry.TimeRemain = TimeRemain--;
+        // saved in the order of `operations`, so operations[i] owns SnakeInfoRevokeList[i]
+        r_entry.SnakeInfoRevokeList.reserve(operations.size());
+        auto save_snake = [&](const SnakeInfo& snake) {
             r_entry.SnakeInfoRevokeList.push_back(RevokeEntry::SnakeInfoRevokeEntry{
-                .Idx = op.Idx,
+                .Idx = snake.Idx,
                 .Alive = snake.Alive,
                 .Score = snake.Score,
                 .LastOperation = snake.LastOperation,
                 .ShieldCD = snake.ShieldCD,
                 .ShieldET = snake.ShieldET,
             });
-            snake_revoke_entry_idxs[op.Idx] = r_entry.SnakeInfoRevokeList.size() - 1;
-            if (op.Op == Operation::Shield) {
-                if (snake.ShieldCD > 0) {
-                    ImagineDeath(op.Idx, r_entry);
-                } else {
-                    snake.ShieldCD = ShieldCD;
-                    snake.ShieldET = ShieldET;
-                    snake.Score -= ShieldCost;
+        };
+        if constexpr (ShieldRules) {
+            for (const auto& op : operations) {
+                SnakeInfo& snake = SnakeInfos[op.Idx];
+                save_snake(snake);
+                if (op.Op == Operation::Shield) {
+                    if (snake.ShieldCD > 0) {
+                        ImagineDeath(op.Idx, r_entry);
+                    } else {
+                        snake.ShieldCD = ShieldCD;
+                        snake.ShieldET = ShieldET;
+                        snake.Score -= ShieldCost;
+                    }
                 }
             }
         }
-        for (const auto& op : operations) {
+        for (size_t i = 0; i < operations.size(); i++) {
+            const auto& op = operations[i];
             SnakeInfo& snake = SnakeInfos[op.Idx];
             const Operation operation = op.Op;
-            if (op.Op != Operation::Shield) {
+            if constexpr (ShieldRules) {
+                if (operation == Operation::Shield) {
+                    continue;
+                }
                 if (snake.ShieldET > 0) {
                     snake.ShieldET--;
                 }
                 if (snake.ShieldCD > 0) {
                     snake.ShieldCD--;
                 }
-                const int dh = DhOfOperation(operation);
-                const int dw = DwOfOperation(operation);
-                const int head_h = snake.Body.front().h;
-                const int head_w = snake.Body.front().w;
-                const int head_h_next = head_h + dh;
-                const int head_w_next = head_w + dw;
-                if (head_h_next < 0 || head_h_next >= Height || head_w_next < 0 || head_w_next >= Width) {
-                    ImagineDeath(op.Idx, r_entry);
-                    continue;
+            } else {
+                save_snake(snake);
+                if (snake.ShieldCD > 0) {
+                    snake.ShieldCD--;
                 }
-                const Cell head_next_cell = Map[head_h_next][head_w_next];
-                r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
-                    .H = head_h_next,
-                    .W = head_w_next,
-                    .Last = head_next_cell,
-                });
-                const int tail_h = snake.Body.back().h;
-                const int tail_w = snake.Body.back().w;
-                r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
-                    .H = tail_h,
-                    .W = tail_w,
-                    .Last = Map[tail_h][tail_w],
-                });
-                r_entry.SnakeInfoRevokeList[snake_revoke_entry_idxs[op.Idx]].BodyRevokeList.push_back(RevokeEntry::BodyRevokeAction{
-                    .Op = RevokeEntry::ListOperation::PopFront,
-                });
-                r_entry.SnakeInfoRevokeList[snake_revoke_entry_idxs[op.Idx]].BodyRevokeList.push_back(RevokeEntry::BodyRevokeAction{
-                    .Op = RevokeEntry::ListOperation::PushBack,
-                    .P = snake.Body.back(),
-                });
-
-                // Move Logic
-                snake.Body.push_front(Point{.h = head_h_next, .w = head_w_next});
-                snake.Body.pop_back();
-                Map[head_h_next][head_w_next].SnakeIdx = op.Idx;  // do not change Obj
-                Map[tail_h][tail_w] = Cell{.SnakeIdx = EmptyIdx, .Obj = None};
             }
+            const int dh = DhOfOperation(operation);
+            const int dw = DwOfOperation(operation);
+            const int head_h = snake.Body.front().h;
+            const int head_w = snake.Body.front().w;
+            const int head_h_next = head_h + dh;
+            const int head_w_next = head_w + dw;
+            if (head_h_next < 0 || head_h_next >= Height || head_w_next < 0 || head_w_next >= Width) {
+                ImagineDeath(op.Idx, r_entry);
+                continue;
+            }
+            const Cell head_next_cell = Map[head_h_next][head_w_next];
+            r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
+                .H = head_h_next,
+                .W = head_w_next,
+                .Last = head_next_cell,
+            });
+            const int tail_h = snake.Body.back().h;
+            const int tail_w = snake.Body.back().w;
+            r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
+                .H = tail_h,
+                .W = tail_w,
+                .Last = Map[tail_h][tail_w],
+            });
+            auto& body_revoke_list = r_entry.SnakeInfoRevokeList[i].BodyRevokeList;
+            body_revoke_list.push_back(RevokeEntry::BodyRevokeAction{
+                .Op = RevokeEntry::ListOperation::PopFront,
+            });
+            body_revoke_list.push_back(RevokeEntry::BodyRevokeAction{
+                .Op = RevokeEntry::ListOperation::PushBack,
+                .P = snake.Body.back(),
+            });
+
+            // Move Logic
+            snake.Body.push_front(Point{.h = head_h_next, .w = head_w_next});
+            snake.Body.pop_back();
+            Map[head_h_next][head_w_next].SnakeIdx = op.Idx;  // do not change Obj
+            Map[tail_h][tail_w] = Cell{.SnakeIdx = EmptyIdx, .Obj = None};
         }
-        for (const auto& op : operations) {
+        for (size_t i = 0; i < operations.size(); i++) {
+            const auto& op = operations[i];
             SnakeInfo& snake = SnakeInfos[op.Idx];
             const int head_h = snake.Body.front().h;
             const int head_w = snake.Body.front().w;
@@ -746,38 +1281,157 @@ struct Game {
             }
             Map[head_h][head_w].Obj = None;
             lengthen += snake.Score / ScorePerLength - old_score / ScorePerLength;
-            lengthen = (lucky_tail_for_other_snake && snake.Idx != SelfIdx && (TotalTime - TimeRemain) % 10 == 0) ? LengthOfLengthBean : lengthen;
+            if constexpr (GrowthRule) {
+                lengthen = (lucky_tail_for_other_snake && snake.Idx != SelfIdx && (TotalTime - TimeRemain) % 10 == 0) ? LengthOfLengthBean : lengthen;
+            }
             if (lengthen-- > 0) {
-                ImagineTailLengthen(op.Idx, r_entry, snake_revoke_entry_idxs);
+                ImagineTailLengthen(op.Idx, r_entry, r_entry.SnakeInfoRevokeList[i]);
             }
         }
-        for (const auto& op : operations) {
-            if (!SnakeInfos[op.Idx].Alive || SnakeInfos[op.Idx].ShieldET > 0) {
+        ImagineCollisions<ShieldRules>(operations, r_entry);
+        UpdateMapHash(r_entry);
+        RevokeStack.push(std::move(r_entry));
+    }
+
+   public:
+    void ImagineTailLengthen(int snake_idx, RevokeEntry& r_entry, RevokeEntry::SnakeInfoRevokeEntry& snake_r_entry) {
+        const int tail_h = SnakeInfos[snake_idx].Body.back().h;
+        const int tail_w = SnakeInfos[snake_idx].Body.back().w;
+        const int pre_tail_h = (++SnakeInfos[snake_idx].Body.rbegin())->h;
+        const int pre_tail_w = (++SnakeInfos[snake_idx].Body.rbegin())->w;
+        Operation direction = Invalid;
+        for (auto i : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+            if (pre_tail_h + DhOfOperation(i) == tail_h && pre_tail_w + DwOfOperation(i) == tail_w) {
+                direction = i;
+                break;
+            }
+        }
+        if (direction == Operation::Right) {
+            if (tail_w == 39) {
+                if (tail_h == 29)
+                    direction = Operation::Up;
+                else
+                    direction = Operation::Down;
+            } else {
+                direction = Operation::Right;
+            }
+        } else if (direction == Operation::Down) {
+            if (tail_h == 29) {
+                if (tail_w == 39)
+                    direction = Operation::Left;
+                else
+                    direction = Operation::Right;
+            } else {
+                direction = Operation::Down;
+            }
+        } else if (direction == Operation::Left) {
+            if (tail_w == 0) {
+                if (tail_h == 29)
+                    direction = Operation::Up;
+                else
+                    direction = Operation::Down;
+            } else {
+                direction = Operation::Left;
+            }
+        } else {
+            if (tail_h == 0) {
+                if (tail_w == 39)
+                    direction = Operation::Left;
+                else
+                    direction = Operation::Right;
+            } else {
+                direction = Operation::Up;
+            }
+        }
+        const int next_h = tail_h + DhOfOperation(direction);
+        const int next_w = tail_w + DwOfOperation(direction);
+        r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
+            .H = next_h,
+            .W = next_w,
+            .Last = Map[next_h][next_w],
+        });
+        snake_r_entry.BodyRevokeList.push_back(RevokeEntry::BodyRevokeAction{
+            .Op = RevokeEntry::ListOperation::PopBack,
+        });
+        Map[next_h][next_w].SnakeIdx = snake_idx;
+        SnakeInfos[snake_idx].Body.push_back(Point{.h = next_h, .w = next_w});
+    }
+
+    void ImagineDeath(int snake_idx, RevokeEntry& r_entry) {
+        int s_score = SnakeInfos[snake_idx].Score;
+        for (const auto& point : SnakeInfos[snake_idx].Body) {
+            r_entry.MapRevokeList.push_back(RevokeEntry::MapRevokeEntry{
+                .H = point.h,
+                .W = point.w,
+                .Last = Map[point.h][point.w],
+            });
+            Map[point.h][point.w] = {.SnakeIdx = EmptyIdx, .Obj = None};
+            if (s_score <= 0) {
+                break;
+            }
+            if (Map[point.h][point.w].Obj != None) {
                 continue;
             }
-            SnakeInfo& snake = SnakeInfos[op.Idx];
-            for (auto& other_snake : SnakeInfos) {
-                if (other_snake.Idx == snake.Idx) {
-                    continue;
-                }
-                for (auto& point : other_snake.Body) {
-                    if (point.h == snake.Body.front().h && point.w == snake.Body.front().w) {
-                        if (point.h == other_snake.Body.front().h && point.w == other_snake.Body.front().w) {
-                            ImagineDeath(other_snake.Idx, r_entry);
-                        }
-                        ImagineDeath(op.Idx, r_entry);
-                        break;
-                    }
-                }
+            if (s_score >= 20) {
+                Map[point.h][point.w].Obj = ScoreTwenty;
+                s_score -= 20;
+            } else {
+                Map[point.h][point.w].Obj = (ObjType)(ScoreZero + s_score);
+                s_score = 0;
             }
         }
-        RevokeStack.push(r_entry);
+        SnakeInfos[snake_idx].Alive = false;
+        // SnakeInfos[snake_idx].Body.clear();
+    }
+
+    // `operations` must be sorted by Idx. Most ticks use no shield and grow no tail, so they run
+    // an instantiation of the rules without those checks.
+    void ImagineOperations(std::span<const SnakeIdxAndOperation> operations, bool lucky_tail_for_other_snake) {
+        const PhaseScope phase(Phase::Simulate);
+        bool shield_rules = false;
+        for (const auto& op : operations) {
+            const SnakeInfo& snake = SnakeInfos[op.Idx];
+            shield_rules |= op.Op == Operation::Shield || snake.ShieldET > 0;
+        }
+        const bool growth_rule = lucky_tail_for_other_snake && (TotalTime - (TimeRemain - 1)) % 10 == 0;
+        if (shield_rules) {
+            growth_rule ? ImagineOperationsWith<true, true>(operations, lucky_tail_for_other_snake)
+                        : ImagineOperationsWith<true, false>(operations, lucky_tail_for_other_snake);
+        } else {
+            growth_rule ? ImagineOperationsWith<false, true>(operations, lucky_tail_for_other_snake)
+                        : ImagineOperationsWith<false, false>(operations, lucky_tail_for_other_snake);
+        }
+    }
+
+    // Every rule checked for every snake: what the instantiations are verified against.
+    void ImagineOperationsGeneral(std::span<const SnakeIdxAndOperation> operations, bool lucky_tail_for_other_snake) {
+        ImagineOperationsWith<true, true>(operations, lucky_tail_for_other_snake);
+    }
+
+    // Takes a snake out between ticks, as the judge does to a bot that fails to answer. Revoked
+    // like a tick.
+    void ImagineElimination(int snake_idx) {
+        RevokeEntry r_entry;
+        r_entry.TimeRemain = TimeRemain;
+        const SnakeInfo& snake = SnakeInfos[snake_idx];
+        r_entry.SnakeInfoRevokeList.push_back(RevokeEntry::SnakeInfoRevokeEntry{
+            .Idx = snake.Idx,
+            .Alive = snake.Alive,
+            .Score = snake.Score,
+            .LastOperation = snake.LastOperation,
+            .ShieldCD = snake.ShieldCD,
+            .ShieldET = snake.ShieldET,
+        });
+        ImagineDeath(snake_idx, r_entry);
+        UpdateMapHash(r_entry);
+        RevokeStack.push(std::move(r_entry));
     }
 
     void RevokeOperations() {
-        RevokeEntry r_entry = RevokeStack.top();
+        const PhaseScope phase(Phase::Revoke);
+        RevokeEntry r_entry = std::move(RevokeStack.top());
         RevokeStack.pop();
-        TimeRemain++;
+        TimeRemain = r_entry.TimeRemain;
         for (int i = r_entry.SnakeInfoRevokeList.size() - 1; i >= 0; i--) {
             auto& item = r_entry.SnakeInfoRevokeList[i];
             SnakeInfos[item.Idx].Alive = item.Alive;
@@ -808,557 +1462,3706 @@ struct Game {
             auto& item = r_entry.MapRevokeList[i];
             Map[item.H][item.W] = item.Last;
         }
+        MapHash = r_entry.MapHash;
     }
 };
 
 //
-//  Value System
+//  Static Terrain Distances
 //
 
-Field<double> CreateDangerField(Game& game) {
-    // Danger Field
-    Field<double> DangerField(VeryLargeValue);
-    std::vector<std::pair<Point, double>> dijkstra_source;
-    bool i_have_shield = game.SnakeInfos[game.SelfIdx].ShieldET > 0;
-    for (int h = 0; h < Height; h++) {
-        for (int w = 0; w < Width; w++) {
-            switch (game.Map[h][w].Obj) {
-                case Trap:
-                    dijkstra_source.push_back({
-                        {h, w},
-                        ValueOfTrap,
-                    });
-                    break;
+constexpr int CellCount = Height * Width;
+constexpr uint16_t UnreachableDistance = 0xFFFF;
 
-                case Wall:
-                    dijkstra_source.push_back({
-                        {h, w},
-                        ValueOfDeathPerRemainTime * game.TimeRemain,
-                    });
-                    break;
+int CellIdxOf(int h, int w) {
+    return h * Width + w;
+}
 
-                default:
-                    if (game.Map[h][w].SnakeIdx != EmptyIdx) {
-                        SnakeInfo& snake = game.SnakeInfos[game.Map[h][w].SnakeIdx];
-                        if (snake.Idx == game.SelfIdx) {
-                            continue;
-                        }
-                        if (i_have_shield) {
-                            dijkstra_source.push_back({
-                                {h, w},
-                                ValueOfOpponentWhenHaveShield,
-                            });
-                        } else {
-                            dijkstra_source.push_back({
-                                {h, w},
-                                ValueOfDeathPerRemainTime * game.TimeRemain,
-                            });
-                        }
-                    }
-                    break;
+// Neighbours of a cell index in the order Left, Up, Right, Down; returns the count written.
+int NeighborCellIdxs(int idx, int neighbors[4]) {
+    const int h = idx / Width;
+    const int w = idx % Width;
+    int cnt = 0;
+    if (w > 0)
+        neighbors[cnt++] = idx - 1;
+    if (h > 0)
+        neighbors[cnt++] = idx - Width;
+    if (w < Width - 1)
+        neighbors[cnt++] = idx + 1;
+    if (h < Height - 1)
+        neighbors[cnt++] = idx + Width;
+    return cnt;
+}
+
+// Wall-only all-pairs distances (CellCount x CellCount uint16, ~2.9 MB) for cheap lower bounds.
+// Rows are filled lazily on first use and dropped when the walls change,
+// so a query costs a table lookup once its row exists.
+class TerrainDistanceCache {
+   private:
+    bool walls[CellCount] = {};
+    std::unique_ptr<uint16_t[]> distances;
+    std::vector<bool> row_valid;
+
+    uint16_t* RawRow(int source) {
+        return distances.get() + (size_t)source * CellCount;
+    }
+
+    void BuildRow(int source) {
+        uint16_t* row = RawRow(source);
+        std::fill(row, row + CellCount, UnreachableDistance);
+        int queue[CellCount];
+        int queue_head = 0, queue_tail = 0;
+        row[source] = 0;
+        queue[queue_tail++] = source;
+        while (queue_head < queue_tail) {
+            const int current = queue[queue_head++];
+            int neighbors[4];
+            const int neighbor_cnt = NeighborCellIdxs(current, neighbors);
+            for (int i = 0; i < neighbor_cnt; i++) {
+                const int next = neighbors[i];
+                if (walls[next] || row[next] != UnreachableDistance) {
+                    continue;
+                }
+                row[next] = row[current] + 1;
+                queue[queue_tail++] = next;
             }
         }
+        row_valid[source] = true;
     }
-    if (EnableSpreadableDangerAroundOpponentHead) {
-        for (int idx = 0; idx < (int)game.SnakeInfos.size(); idx++) {
-            if (!game.SnakeInfos[idx].Alive || idx == game.SelfIdx) {
-                continue;
-            }
-            const int head_h = game.SnakeInfos[idx].Body.front().h;
-            const int head_w = game.SnakeInfos[idx].Body.front().w;
-            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-                if (direction == Reverse(game.SnakeInfos[idx].LastOperation)) {
-                    continue;
+
+   public:
+    TerrainDistanceCache()
+        : distances(new uint16_t[(size_t)CellCount * CellCount]), row_valid(CellCount, false) {}
+
+    TerrainDistanceCache(TerrainDistanceCache& cache) = delete;
+    void operator=(TerrainDistanceCache& cache) = delete;
+
+    // Bring the cached wall layout in line with `game`. Any wall change drops every row; they
+    // are rebuilt on their next use, which is cheaper than repairing rows nobody asks for again.
+    void Sync(const Game& game) {
+        bool changed = false;
+        for (int h = 0; h < Height; h++) {
+            for (int w = 0; w < Width; w++) {
+                const bool is_wall = game.Map[h][w].Obj == Wall;
+                if (is_wall != walls[CellIdxOf(h, w)]) {
+                    walls[CellIdxOf(h, w)] = is_wall;
+                    changed = true;
                 }
-                const int h_next = head_h + DhOfOperation(direction);
-                const int w_next = head_w + DwOfOperation(direction);
-                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
+            }
+        }
+        if (changed) {
+            std::fill(row_valid.begin(), row_valid.end(), false);
+        }
+    }
+
+    const uint16_t* Row(Point source) {
+        const int idx = CellIdxOf(source.h, source.w);
+        if (!row_valid[idx]) {
+            BuildRow(idx);
+        }
+        return RawRow(idx);
+    }
+
+    // Admissible lower bound of the distance once snake bodies and traps are taken into account.
+    int Distance(Point from, Point to) {
+        const uint16_t distance = Row(from)[CellIdxOf(to.h, to.w)];
+        return distance == UnreachableDistance ? -1 : distance;
+    }
+};
+
+thread_local TerrainDistanceCache TerrainDistances;
+
+//
+//  Sector Distances
+//
+
+// Approximate distances through a graph of sectors, for boards where a search per object costs
+// too much. The board is cut into SectorSize squares, and where open cells face each other across
+// a sector border, every run of them gets portals, a cell on each side. A sector keeps the
+// distances from its portals to its own cells and rebuilds them only when the open cells in it
+// or in the ring around it change. A distance runs from the source to the portals of its sector,
+// across the portal graph, then from the portals of the target's sector to the target, so it is
+// never shorter than the true one, and each cell costs a pass over its sector's portals.
+constexpr int SectorSize = 8;
+constexpr int SectorRows = (Height + SectorSize - 1) / SectorSize;
+constexpr int SectorCols = (Width + SectorSize - 1) / SectorSize;
+constexpr int SectorCellCount = SectorSize * SectorSize;
+constexpr int PortalRunSplit = 6;  // a run this long gets a portal at both ends instead of the middle
+constexpr uint8_t SectorUnreachable = 0xFF;
+
+class SectorDistanceGraph {
+    struct Portal {
+        int Cell;
+        int Across[4];  // cells of the portals facing it in neighbouring sectors
+        int AcrossCnt;
+        uint8_t Distances[SectorCellCount];  // to the cells of its sector, by LocalIdx
+    };
+    struct Sector {
+        uint64_t Key = 0;  // of the open cells in and around the sector; 0: never built
+        std::vector<Portal> Portals;
+    };
+
+    Sector sectors[SectorRows * SectorCols];
+    bool open[CellCount];
+    // the portal graph of the last Sync: node ids number the portals sector by sector
+    int first_node[SectorRows * SectorCols + 1];
+    int node_of_cell[CellCount];
+    std::vector<int> node_distances;
+
+    static int SectorOf(int idx) { return idx / Width / SectorSize * SectorCols + idx % Width / SectorSize; }
+    static int LocalIdx(int idx) { return idx / Width % SectorSize * SectorSize + idx % Width % SectorSize; }
+
+    // Distances within the sector from `source`, which counts as open.
+    void SearchSector(int sector, int source, uint8_t* distances) const {
+        std::fill(distances, distances + SectorCellCount, SectorUnreachable);
+        int queue[SectorCellCount];
+        int queue_head = 0, queue_tail = 0;
+        distances[LocalIdx(source)] = 0;
+        queue[queue_tail++] = source;
+        while (queue_head < queue_tail) {
+            const int current = queue[queue_head++];
+            int neighbors[4];
+            const int neighbor_cnt = NeighborCellIdxs(current, neighbors);
+            for (int i = 0; i < neighbor_cnt; i++) {
+                const int next = neighbors[i];
+                if (!open[next] || SectorOf(next) != sector || distances[LocalIdx(next)] != SectorUnreachable) {
                     continue;
                 }
-                dijkstra_source.push_back({
-                    {h_next, w_next},
-                    ValueOfDeathPerRemainTime * game.TimeRemain * PenaltyDeclineOfHeadToHeadDeath,
-                });
+                distances[LocalIdx(next)] = distances[LocalIdx(current)] + 1;
+                queue[queue_tail++] = next;
             }
         }
     }
-    DangerField.DijkstrativeReduce(dijkstra_source, [&](Point p, auto updater) {
-        int h = p.h;
-        int w = p.w;
-        for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-            const int h_next = h + DhOfOperation(direction);
-            const int w_next = w + DwOfOperation(direction);
-            if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
-                continue;
-            }
-            const int h_next_left = h_next + DhOfOperation(Operation::Left);
-            const int w_next_left = w_next + DwOfOperation(Operation::Left);
-            const int h_next_right = h_next + DhOfOperation(Operation::Right);
-            const int w_next_right = w_next + DwOfOperation(Operation::Right);
-            const int h_next_up = h_next + DhOfOperation(Operation::Up);
-            const int w_next_up = w_next + DwOfOperation(Operation::Up);
-            const int h_next_down = h_next + DhOfOperation(Operation::Down);
-            const int w_next_down = w_next + DwOfOperation(Operation::Down);
-            const double danger_left = (h_next_left < 0 || h_next_left >= Height || w_next_left < 0 || w_next_left >= Width)
-                                           ? ValueOfDeathPerRemainTime * game.TimeRemain
-                                           : DangerField[h_next_left][w_next_left];
-            const double danger_right = (h_next_right < 0 || h_next_right >= Height || w_next_right < 0 || w_next_right >= Width)
-                                            ? ValueOfDeathPerRemainTime * game.TimeRemain
-                                            : DangerField[h_next_right][w_next_right];
-            const double danger_up = (h_next_up < 0 || h_next_up >= Height || w_next_up < 0 || w_next_up >= Width)
-                                         ? ValueOfDeathPerRemainTime * game.TimeRemain
-                                         : DangerField[h_next_up][w_next_up];
-            const double danger_down = (h_next_down < 0 || h_next_down >= Height || w_next_down < 0 || w_next_down >= Width)
-                                           ? ValueOfDeathPerRemainTime * game.TimeRemain
-                                           : DangerField[h_next_down][w_next_down];
-            const double danger = std::min({
-                std::max({danger_left, danger_right, danger_up}),
-                std::max({danger_left, danger_right, danger_down}),
-                std::max({danger_left, danger_up, danger_down}),
-                std::max({danger_right, danger_up, danger_down}),
-            });
-            if (danger < DangerField[h_next][w_next]) {
-                updater({h_next, w_next}, danger);
+
+    uint64_t SectorKey(int sector) const {
+        const int top = sector / SectorCols * SectorSize, left = sector % SectorCols * SectorSize;
+        uint64_t key = Mix64(sector);
+        for (int h = std::max(0, top - 1); h <= std::min(Height - 1, top + SectorSize); h++) {
+            uint64_t bits = 0;
+            for (int w = std::max(0, left - 1); w <= std::min(Width - 1, left + SectorSize); w++) {
+                bits = bits << 1 | open[CellIdxOf(h, w)];
             }
+            key = Mix64(key ^ bits ^ (uint64_t)h << 32);
         }
-    });
-    if (!EnableSpreadableDangerAroundOpponentHead) {
-        for (int idx = 0; idx < (int)game.SnakeInfos.size(); idx++) {
-            if (!game.SnakeInfos[idx].Alive || idx == game.SelfIdx) {
-                continue;
+        return key | 1;
+    }
+
+    // Portals of the sector on each border, from runs of open cells facing open cells. Both
+    // sectors of a border walk it in the same order, so they pick the same pairs.
+    void BuildPortals(int sector) {
+        const int top = sector / SectorCols * SectorSize, left = sector % SectorCols * SectorSize;
+        const int bottom = std::min(Height, top + SectorSize) - 1, right = std::min(Width, left + SectorSize) - 1;
+        std::vector<Portal>& portals = sectors[sector].Portals;
+        portals.clear();
+        auto add = [&](int cell, int across) {
+            auto portal = std::find_if(portals.begin(), portals.end(), [&](const Portal& p) { return p.Cell == cell; });
+            if (portal == portals.end()) {
+                portal = portals.insert(portals.end(), Portal{.Cell = cell, .Across = {}, .AcrossCnt = 0, .Distances = {}});
             }
-            const int head_h = game.SnakeInfos[idx].Body.front().h;
-            const int head_w = game.SnakeInfos[idx].Body.front().w;
-            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-                if (direction == Reverse(game.SnakeInfos[idx].LastOperation)) {
-                    continue;
-                }
-                const int h_next = head_h + DhOfOperation(direction);
-                const int w_next = head_w + DwOfOperation(direction);
-                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
-                    continue;
+            portal->Across[portal->AcrossCnt++] = across;
+        };
+        // a border as the cells along it on our side and the step across it
+        auto scan = [&](int first, int step_along, int length, int step_across) {
+            int run_begin = -1;
+            for (int i = 0; i <= length; i++) {
+                const int cell = first + i * step_along;
+                const bool crossing = i < length && open[cell] && open[cell + step_across];
+                if (crossing && run_begin == -1) {
+                    run_begin = i;
+                } else if (!crossing && run_begin != -1) {
+                    const int run_end = i - 1;
+                    if (run_end - run_begin + 1 >= PortalRunSplit) {
+                        add(first + run_begin * step_along, first + run_begin * step_along + step_across);
+                        add(first + run_end * step_along, first + run_end * step_along + step_across);
+                    } else {
+                        const int middle = first + (run_begin + run_end) / 2 * step_along;
+                        add(middle, middle + step_across);
+                    }
+                    run_begin = -1;
                 }
-                DangerField[h_next][w_next] = ValueOfDeathPerRemainTime * game.TimeRemain * PenaltyDeclineOfHeadToHeadDeath;
             }
+        };
+        if (top > 0)
+            scan(CellIdxOf(top, left), 1, right - left + 1, -Width);
+        if (bottom < Height - 1)
+            scan(CellIdxOf(bottom, left), 1, right - left + 1, Width);
+        if (left > 0)
+            scan(CellIdxOf(top, left), Width, bottom - top + 1, -1);
+        if (right < Width - 1)
+            scan(CellIdxOf(top, right), Width, bottom - top + 1, 1);
+        for (Portal& portal : portals) {
+            SearchSector(sector, portal.Cell, portal.Distances);
         }
     }
-    return DangerField;
-}
 
-Field<int> CreateDistanceField(Game& game, Point point) {
-    Field<int> DistanceField(-1);
-    DistanceField.DijkstrativeReduce(
-        {{point, 0}}, [&](Point p, auto updater) {
-            int h = p.h;
-            int w = p.w;
-            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-                int h_next = h + DhOfOperation(direction);
-                int w_next = w + DwOfOperation(direction);
-                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
-                    continue;
-                }
-                if (game.Map[h_next][w_next].Obj == Wall ||
-                    game.Map[h_next][w_next].Obj == Trap) {
-                    continue;
-                }
-                if (game.Map[h_next][w_next].SnakeIdx != EmptyIdx && game.Map[h_next][w_next].SnakeIdx != game.SelfIdx) {
-                    continue;
+   public:
+    // Takes the open cells from `blocked` and rebuilds the sectors they changed.
+    template <typename Blocked>
+    void Sync(Blocked blocked) {
+        for (int idx = 0; idx < CellCount; idx++) {
+            open[idx] = !blocked(idx);
+        }
+        first_node[0] = 0;
+        for (int sector = 0; sector < SectorRows * SectorCols; sector++) {
+            const uint64_t key = SectorKey(sector);
+            if (key != sectors[sector].Key) {
+                sectors[sector].Key = key;
+                BuildPortals(sector);
+            }
+            first_node[sector + 1] = first_node[sector] + sectors[sector].Portals.size();
+        }
+        std::fill(node_of_cell, node_of_cell + CellCount, -1);
+        for (int sector = 0; sector < SectorRows * SectorCols; sector++) {
+            for (int i = 0; i < (int)sectors[sector].Portals.size(); i++) {
+                node_of_cell[sectors[sector].Portals[i].Cell] = first_node[sector] + i;
+            }
+        }
+    }
+
+    // Distances from `source`, which counts as open, to every cell, as of the last Sync; -1 for
+    // cells blocked or out of reach.
+    void DistancesFrom(Point source, int* result) {
+        const int source_idx = CellIdxOf(source.h, source.w);
+        const int source_sector = SectorOf(source_idx);
+        uint8_t local[SectorCellCount];
+        SearchSector(source_sector, source_idx, local);
+
+        // Dijkstra over the portals; edges inside a sector come from its tables
+        node_distances.assign(first_node[SectorRows * SectorCols], INT_MAX);
+        std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> queue;
+        for (int i = 0; i < (int)sectors[source_sector].Portals.size(); i++) {
+            const uint8_t distance = local[LocalIdx(sectors[source_sector].Portals[i].Cell)];
+            if (distance != SectorUnreachable) {
+                node_distances[first_node[source_sector] + i] = distance;
+                queue.push({distance, first_node[source_sector] + i});
+            }
+        }
+        while (!queue.empty()) {
+            const auto [distance, node] = queue.top();
+            queue.pop();
+            if (distance > node_distances[node]) {
+                continue;
+            }
+            const int sector = std::upper_bound(first_node, first_node + SectorRows * SectorCols + 1, node) - first_node - 1;
+            const Portal& portal = sectors[sector].Portals[node - first_node[sector]];
+            auto relax = [&](int next, int next_distance) {
+                if (next_distance < node_distances[next]) {
+                    node_distances[next] = next_distance;
+                    queue.push({next_distance, next});
+                }
+            };
+            for (int i = 0; i < (int)sectors[sector].Portals.size(); i++) {
+                const uint8_t step = portal.Distances[LocalIdx(sectors[sector].Portals[i].Cell)];
+                if (step != SectorUnreachable) {
+                    relax(first_node[sector] + i, distance + step);
+                }
+            }
+            for (int i = 0; i < portal.AcrossCnt; i++) {
+                relax(node_of_cell[portal.Across[i]], distance + 1);
+            }
+        }
+
+        for (int idx = 0; idx < CellCount; idx++) {
+            if (!open[idx] && idx != source_idx) {
+                result[idx] = -1;
+                continue;
+            }
+            const int sector = SectorOf(idx);
+            const int local_idx = LocalIdx(idx);
+            int best = sector == source_sector && local[local_idx] != SectorUnreachable ? local[local_idx] : INT_MAX;
+            for (int i = 0; i < (int)sectors[sector].Portals.size(); i++) {
+                const int via = node_distances[first_node[sector] + i];
+                const uint8_t step = sectors[sector].Portals[i].Distances[local_idx];
+                if (via != INT_MAX && step != SectorUnreachable) {
+                    best = std::min(best, via + step);
+                }
+            }
+            result[idx] = best == INT_MAX ? -1 : best;
+        }
+    }
+};
+
+thread_local SectorDistanceGraph SectorDistances;
+
+//
+//  Territory
+//
+
+constexpr int BoardWordCount = (CellCount + 63) / 64;
+constexpr int NoOwner = -1;
+constexpr int ContestedOwner = -2;
+constexpr uint8_t NeverArrive = 0xFF;
+
+// One bit per cell, row-major like CellIdxOf. Bits past CellCount are always kept clear.
+struct BitBoard {
+    uint64_t Words[BoardWordCount];
+
+    static BitBoard Empty() {
+        BitBoard board;
+        std::fill(board.Words, board.Words + BoardWordCount, 0);
+        return board;
+    }
+
+    static BitBoard Column(int w) {
+        BitBoard board = Empty();
+        for (int h = 0; h < Height; h++) {
+            board.Set(CellIdxOf(h, w));
+        }
+        return board;
+    }
+
+    void Set(int idx) {
+        Words[idx >> 6] |= 1ull << (idx & 63);
+    }
+
+    bool Test(int idx) const {
+        return (Words[idx >> 6] >> (idx & 63)) & 1;
+    }
+
+    // Word `i` of the board of cells one step away from a set cell, given words i - 1, i and i + 1.
+    static uint64_t NeighborWord(uint64_t prev, uint64_t word, uint64_t next, int i) {
+        static const BitBoard FirstColumn = Column(0);
+        static const BitBoard LastColumn = Column(Width - 1);
+        const uint64_t to_left = word & ~FirstColumn.Words[i];
+        const uint64_t next_to_left = i + 1 < BoardWordCount ? next & ~FirstColumn.Words[i + 1] : 0;
+        const uint64_t to_right = word & ~LastColumn.Words[i];
+        const uint64_t prev_to_right = i > 0 ? prev & ~LastColumn.Words[i - 1] : 0;
+        uint64_t result = (to_left >> 1) | (next_to_left << 63) |
+                          (to_right << 1) | (prev_to_right >> 63) |
+                          (word >> Width) | (next << (64 - Width)) |
+                          (word << Width) | (prev >> (64 - Width));
+        if (CellCount % 64 != 0 && i == BoardWordCount - 1) {
+            result &= (1ull << (CellCount % 64)) - 1;
+        }
+        return result;
+    }
+};
+static_assert(Width < 64, "BitBoard::NeighborWord shifts rows within two adjacent words");
+
+// Which snake reaches each cell first when all live heads expand at once.
+// Bodies, walls and traps block; cells reached by several snakes in the same tick are contested
+// and do not expand further.
+struct Territory {
+    int8_t Owner[CellCount];     // snake idx, NoOwner or ContestedOwner
+    uint8_t Arrival[CellCount];  // ticks until the owner (or contenders) arrive, NeverArrive if unreached
+    BitBoard Contested;
+    std::vector<int> Area;       // owned cells per snake, including its head
+};
+
+Territory CreateTerritory(const Game& game) {
+    // each frontier only touches the words it spans, and is advanced in place word by word
+    struct Frontier {
+        BitBoard Board;
+        int Lo, Hi;  // span of non-zero words
+        int Owner;
+    };
+
+    const int snake_cnt = game.SnakeInfos.size();
+    Territory territory;
+    std::fill(territory.Owner, territory.Owner + CellCount, NoOwner);
+    std::fill(territory.Arrival, territory.Arrival + CellCount, NeverArrive);
+    territory.Contested = BitBoard::Empty();
+    territory.Area.assign(snake_cnt, 0);
+
+    BitBoard claimed = BitBoard::Empty();
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            const Cell& cell = game.Map[h][w];
+            if (cell.Obj == Wall || cell.Obj == Trap || cell.SnakeIdx != EmptyIdx) {
+                claimed.Set(CellIdxOf(h, w));
+            }
+        }
+    }
+    std::vector<Frontier> frontiers;
+    for (const SnakeInfo& snake : game.SnakeInfos) {
+        if (!snake.Alive) {
+            continue;
+        }
+        const int head = CellIdxOf(snake.Body.front().h, snake.Body.front().w);
+        Frontier frontier{.Board = BitBoard::Empty(), .Lo = head >> 6, .Hi = head >> 6, .Owner = snake.Idx};
+        frontier.Board.Set(head);
+        frontiers.push_back(frontier);
+        territory.Owner[head] = snake.Idx;
+        territory.Arrival[head] = 0;
+        territory.Area[snake.Idx]++;
+    }
+
+    for (int tick = 1; tick < NeverArrive; tick++) {
+        BitBoard reached_once = BitBoard::Empty(), reached_twice = BitBoard::Empty();
+        int range_lo = BoardWordCount, range_hi = -1;
+        for (Frontier& frontier : frontiers) {
+            if (frontier.Lo > frontier.Hi) {
+                continue;
+            }
+            const int lo = std::max(0, frontier.Lo - 1);
+            const int hi = std::min(BoardWordCount - 1, frontier.Hi + 1);
+            uint64_t prev = 0;  // words below `lo` are empty
+            frontier.Lo = BoardWordCount;
+            frontier.Hi = -1;
+            for (int i = lo; i <= hi; i++) {
+                const uint64_t word = frontier.Board.Words[i];
+                const uint64_t next = i + 1 < BoardWordCount ? frontier.Board.Words[i + 1] : 0;
+                const uint64_t reached = BitBoard::NeighborWord(prev, word, next, i) & ~claimed.Words[i];
+                frontier.Board.Words[i] = reached;
+                prev = word;
+                reached_twice.Words[i] |= reached_once.Words[i] & reached;
+                reached_once.Words[i] |= reached;
+                if (reached) {
+                    frontier.Lo = std::min(frontier.Lo, i);
+                    frontier.Hi = i;
+                }
+            }
+            range_lo = std::min(range_lo, lo);
+            range_hi = std::max(range_hi, hi);
+        }
+        if (range_lo > range_hi) {
+            break;
+        }
+        for (Frontier& frontier : frontiers) {
+            for (int i = frontier.Lo; i <= frontier.Hi; i++) {
+                uint64_t word = frontier.Board.Words[i] &= ~reached_twice.Words[i];
+                while (word) {
+                    const int idx = i * 64 + __builtin_ctzll(word);
+                    territory.Owner[idx] = frontier.Owner;
+                    territory.Arrival[idx] = tick;
+                    territory.Area[frontier.Owner]++;
+                    word &= word - 1;
+                }
+            }
+        }
+        for (int i = range_lo; i <= range_hi; i++) {
+            uint64_t word = reached_twice.Words[i];
+            while (word) {
+                const int idx = i * 64 + __builtin_ctzll(word);
+                territory.Owner[idx] = ContestedOwner;
+                territory.Arrival[idx] = tick;
+                word &= word - 1;
+            }
+            territory.Contested.Words[i] |= reached_twice.Words[i];
+            claimed.Words[i] |= reached_once.Words[i];
+        }
+    }
+    return territory;
+}
+
+//
+//  Cell Vacate Ticks
+//
+
+constexpr uint16_t NeverVacates = 0xFFFF;  // not free within the horizon of the index
+
+// For the cells under snake bodies, the tick from now in which each one becomes free, assuming
+// every snake keeps moving: the cell `k` places from the tail is free once the tail has retreated
+// `k` times. Opponents' tails stay on the ticks where ImagineOperations grows them, so the index
+// agrees with the search. Only the first `horizon` ticks and the cells within `focus_distance` of
+// `focus` are resolved, others read NeverVacates; cells without a body are not meaningful.
+class VacateIndex {
+   private:
+    uint16_t ticks[CellCount];
+
+   public:
+    VacateIndex(const Game& game, int horizon, Point focus = {CenterH, CenterW}, int focus_distance = Height + Width) {
+        std::fill(ticks, ticks + CellCount, NeverVacates);
+        for (const SnakeInfo& snake : game.SnakeInfos) {
+            // the cells resolved lie within `horizon` of the tail
+            const Point& tail = snake.Body.back();
+            if (!snake.Alive || std::abs(tail.h - focus.h) + std::abs(tail.w - focus.w) > horizon + focus_distance) {
+                continue;
+            }
+            int tick = 0;
+            for (auto it = snake.Body.rbegin(); it != snake.Body.rend(); ++it) {
+                // advance to the next tick in which the tail retreats
+                do {
+                    tick++;
+                } while (snake.Idx != game.SelfIdx && (TotalTime - (game.TimeRemain - tick)) % 10 == 0);
+                if (tick > horizon) {
+                    break;
+                }
+                ticks[CellIdxOf(it->h, it->w)] = tick;
+            }
+        }
+    }
+
+    // Whether the body on (h, w) is gone when someone needing at least `arrival` ticks gets there.
+    bool FreeBy(int h, int w, int arrival) const {
+        return ticks[CellIdxOf(h, w)] <= arrival;
+    }
+};
+
+//
+//  Task Graph
+//
+
+// Runs tasks once their dependencies are done, on the calling thread and `thread_cnt - 1` more.
+// A running task may add further tasks, and Run() returns once every task is done. With one
+// thread the tasks run in the order they become ready on the calling thread. Tasks write only
+// their own outputs, so what the graph computes never depends on the thread count or timing.
+class TaskGraph {
+    struct Task {
+        std::function<void()> Work;
+        int Waiting;  // dependencies not done yet
+        bool Done;
+        std::vector<int> Dependents;
+    };
+    std::deque<Task> tasks;
+    std::deque<int> ready;
+    int unfinished = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this]() { return !ready.empty() || unfinished == 0; });
+            if (ready.empty()) {
+                return;
+            }
+            const int id = ready.front();
+            ready.pop_front();
+            const std::function<void()> work = std::move(tasks[id].Work);
+            lock.unlock();
+            work();
+            lock.lock();
+            tasks[id].Done = true;
+            unfinished--;
+            for (int dependent : tasks[id].Dependents) {
+                if (--tasks[dependent].Waiting == 0) {
+                    ready.push_back(dependent);
+                }
+            }
+            changed.notify_all();
+        }
+    }
+
+   public:
+    int Add(std::function<void()> work, std::initializer_list<int> dependencies = {}) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const int id = tasks.size();
+        tasks.push_back(Task{.Work = std::move(work), .Waiting = 0, .Done = false, .Dependents = {}});
+        for (int dependency : dependencies) {
+            if (!tasks[dependency].Done) {
+                tasks[dependency].Dependents.push_back(id);
+                tasks[id].Waiting++;
+            }
+        }
+        unfinished++;
+        if (tasks[id].Waiting == 0) {
+            ready.push_back(id);
+            changed.notify_one();
+        }
+        return id;
+    }
+
+    void Run(int thread_cnt) {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < thread_cnt; t++) {
+            threads.emplace_back([this]() {
+                Work();
+                MergeThreadInstrumentation();
+            });
+        }
+        Work();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+//
+//  Value System
+//
+
+// Danger is kept in fixed point. The propagation only takes mins and maxes of the source values,
+// which are all multiples of DangerUnit, so int16_t holds every danger exactly in a 2.4 KB field.
+using DangerValue = int16_t;
+constexpr double DangerUnit = 0.5;
+constexpr DangerValue NoDanger = INT16_MAX;  // VeryLargeValue
+static_assert(ValueOfTrap / DangerUnit == (int)(ValueOfTrap / DangerUnit) &&
+                  ValueOfOpponentWhenHaveShield / DangerUnit == (int)(ValueOfOpponentWhenHaveShield / DangerUnit) &&
+                  ValueOfDeathPerRemainTime * PenaltyDeclineOfHeadToHeadDeath / DangerUnit ==
+                      (int)(ValueOfDeathPerRemainTime * PenaltyDeclineOfHeadToHeadDeath / DangerUnit),
+              "danger sources must be multiples of DangerUnit");
+static_assert(ValueOfDeathPerRemainTime * TotalTime / DangerUnit > INT16_MIN, "DangerValue is too narrow");
+
+// Saturates to NoDanger above and to INT16_MIN + 1 below.
+constexpr DangerValue QuantizeDanger(double value) {
+    const double units = value / DangerUnit;
+    if (units >= NoDanger) {
+        return NoDanger;
+    }
+    if (units <= INT16_MIN + 1) {
+        return INT16_MIN + 1;
+    }
+    return (DangerValue)(units < 0 ? units - 0.5 : units + 0.5);
+}
+
+constexpr double DangerToValue(DangerValue danger) {
+    return danger == NoDanger ? VeryLargeValue : danger * DangerUnit;
+}
+
+// Danger a cell starts the propagation with, NoDanger if it is not a source. A body we cannot reach
+// before it has moved on is no source: we need at least the Manhattan distance from `head` to get there.
+DangerValue DangerSourceValue(const Game& game, int h, int w, bool i_have_shield, Point head, const VacateIndex& vacate) {
+    switch (game.Map[h][w].Obj) {
+        case Trap:
+            return QuantizeDanger(ValueOfTrap);
+
+        case Wall:
+            return QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain);
+
+        default:
+            if (game.Map[h][w].SnakeIdx != EmptyIdx && game.Map[h][w].SnakeIdx != game.SelfIdx &&
+                !vacate.FreeBy(h, w, std::abs(h - head.h) + std::abs(w - head.w))) {
+                return QuantizeDanger(i_have_shield ? ValueOfOpponentWhenHaveShield : ValueOfDeathPerRemainTime * game.TimeRemain);
+            }
+            return NoDanger;
+    }
+}
+
+// Solves the danger stencil by whole-grid sweeps instead of a queue: a cell takes the second
+// largest danger of its four neighbours, which is what the min over the four "max of three"
+// combinations comes to, whenever that is lower. Off-map neighbours stay at `border`. Rounds
+// sweep the rows top down and bottom up in turn. Each row is first lowered from a copy of itself,
+// which is branch free and vectorizes; a row that changed is then swept left to right and back in
+// place, so danger runs down a straight corridor in any direction within one round. Lowering is
+// monotone, so the sweeps stop at the same fixed point as the queue, and a round that changes
+// nothing proves it is reached. A path that keeps turning still needs about a round per turn, so
+// after MaxDangerSweepRounds the sweeps give up and return false, leaving `field` partly lowered.
+bool SweepDangerField(Field<DangerValue>& field, DangerValue border) {
+    constexpr int PaddedWidth = Width + 2;
+    DangerValue grid[Height + 2][PaddedWidth];  // padded with border
+    std::fill(&grid[0][0], &grid[0][0] + (Height + 2) * PaddedWidth, border);
+    for (int h = 0; h < Height; h++) {
+        std::copy(field[h], field[h] + Width, &grid[h + 1][1]);
+    }
+    bool changed = true;
+    for (int round = 0; changed && round < MaxDangerSweepRounds; round++) {
+        changed = false;
+        for (int i = 0; i < Height; i++) {
+            const int h = round % 2 == 0 ? i + 1 : Height - i;
+            const DangerValue* up = grid[h - 1];
+            const DangerValue* down = grid[h + 1];
+            DangerValue* row = grid[h];
+            auto stencil = [&](int w) {
+                const DangerValue high_sides = std::max(row[w - 1], row[w + 1]);
+                const DangerValue low_sides = std::min(row[w - 1], row[w + 1]);
+                const DangerValue high_ends = std::max(up[w], down[w]);
+                const DangerValue low_ends = std::min(up[w], down[w]);
+                return std::max(std::min(high_sides, high_ends), std::max(low_sides, low_ends));
+            };
+            DangerValue next[Width];
+            int row_changes = 0;
+            for (int w = 1; w <= Width; w++) {
+                next[w - 1] = std::min(row[w], stencil(w));
+                row_changes |= next[w - 1] != row[w];
+            }
+            if (row_changes == 0) {
+                continue;
+            }
+            changed = true;
+            std::copy(next, next + Width, row + 1);
+            for (int w = 1; w <= Width; w++) {
+                row[w] = std::min(row[w], stencil(w));
+            }
+            for (int w = Width; w >= 1; w--) {
+                row[w] = std::min(row[w], stencil(w));
+            }
+        }
+    }
+    for (int h = 0; h < Height; h++) {
+        std::copy(&grid[h + 1][1], &grid[h + 1][1] + Width, field[h]);
+    }
+    return !changed;
+}
+
+Field<DangerValue> CreateDangerField(Game& game) {
+    const PhaseScope phase(Phase::Fields);
+    // Danger Field
+    Field<DangerValue> DangerField(NoDanger);
+    std::vector<std::pair<Point, DangerValue>> dijkstra_source;
+    const DangerValue death_danger = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain);
+    const DangerValue head_to_head_danger = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain * PenaltyDeclineOfHeadToHeadDeath);
+    bool i_have_shield = game.SnakeInfos[game.SelfIdx].ShieldET > 0;
+    const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+    const VacateIndex vacate(game, Height + Width);
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            const DangerValue value = DangerSourceValue(game, h, w, i_have_shield, head, vacate);
+            if (value != NoDanger) {
+                dijkstra_source.push_back({{h, w}, value});
+            }
+        }
+    }
+    if (EnableSpreadableDangerAroundOpponentHead) {
+        for (int idx = 0; idx < (int)game.SnakeInfos.size(); idx++) {
+            if (!game.SnakeInfos[idx].Alive || idx == game.SelfIdx) {
+                continue;
+            }
+            const int head_h = game.SnakeInfos[idx].Body.front().h;
+            const int head_w = game.SnakeInfos[idx].Body.front().w;
+            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+                if (direction == Reverse(game.SnakeInfos[idx].LastOperation)) {
+                    continue;
+                }
+                const int h_next = head_h + DhOfOperation(direction);
+                const int w_next = head_w + DwOfOperation(direction);
+                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
+                    continue;
+                }
+                dijkstra_source.push_back({{h_next, w_next}, head_to_head_danger});
+            }
+        }
+    }
+    bool solved = false;
+    if constexpr (EnableSweepDangerSolver) {
+        for (const auto& [point, value] : dijkstra_source) {
+            DangerField[point.h][point.w] = value;
+        }
+        solved = SweepDangerField(DangerField, death_danger);
+        if (!solved) {
+            DangerField = Field<DangerValue>(NoDanger);
+        }
+    }
+    if (!solved) {
+        DangerField.DijkstrativeReduce(dijkstra_source, [&](Point p, auto updater) {
+            int h = p.h;
+            int w = p.w;
+            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+                const int h_next = h + DhOfOperation(direction);
+                const int w_next = w + DwOfOperation(direction);
+                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
+                    continue;
+                }
+                const int h_next_left = h_next + DhOfOperation(Operation::Left);
+                const int w_next_left = w_next + DwOfOperation(Operation::Left);
+                const int h_next_right = h_next + DhOfOperation(Operation::Right);
+                const int w_next_right = w_next + DwOfOperation(Operation::Right);
+                const int h_next_up = h_next + DhOfOperation(Operation::Up);
+                const int w_next_up = w_next + DwOfOperation(Operation::Up);
+                const int h_next_down = h_next + DhOfOperation(Operation::Down);
+                const int w_next_down = w_next + DwOfOperation(Operation::Down);
+                const DangerValue danger_left = (h_next_left < 0 || h_next_left >= Height || w_next_left < 0 || w_next_left >= Width)
+                                               ? death_danger
+                                               : DangerField[h_next_left][w_next_left];
+                const DangerValue danger_right = (h_next_right < 0 || h_next_right >= Height || w_next_right < 0 || w_next_right >= Width)
+                                                ? death_danger
+                                                : DangerField[h_next_right][w_next_right];
+                const DangerValue danger_up = (h_next_up < 0 || h_next_up >= Height || w_next_up < 0 || w_next_up >= Width)
+                                             ? death_danger
+                                             : DangerField[h_next_up][w_next_up];
+                const DangerValue danger_down = (h_next_down < 0 || h_next_down >= Height || w_next_down < 0 || w_next_down >= Width)
+                                               ? death_danger
+                                               : DangerField[h_next_down][w_next_down];
+                const DangerValue danger = std::min({
+                    std::max({danger_left, danger_right, danger_up}),
+                    std::max({danger_left, danger_right, danger_down}),
+                    std::max({danger_left, danger_up, danger_down}),
+                    std::max({danger_right, danger_up, danger_down}),
+                });
+                if (danger < DangerField[h_next][w_next]) {
+                    updater({h_next, w_next}, danger);
+                }
+            }
+        });
+    }
+    if (!EnableSpreadableDangerAroundOpponentHead) {
+        for (int idx = 0; idx < (int)game.SnakeInfos.size(); idx++) {
+            if (!game.SnakeInfos[idx].Alive || idx == game.SelfIdx) {
+                continue;
+            }
+            const int head_h = game.SnakeInfos[idx].Body.front().h;
+            const int head_w = game.SnakeInfos[idx].Body.front().w;
+            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+                if (direction == Reverse(game.SnakeInfos[idx].LastOperation)) {
+                    continue;
+                }
+                const int h_next = head_h + DhOfOperation(direction);
+                const int w_next = head_w + DwOfOperation(direction);
+                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
+                    continue;
+                }
+                DangerField[h_next][w_next] = head_to_head_danger;
+            }
+        }
+    }
+    return DangerField;
+}
+
+// Danger values near one point, computed in a small square window instead of the whole board.
+// Cells just outside the window are pinned once to an upper and once to a lower bound of their
+// true danger. The propagation is monotone, so if both runs agree on the inner cells those are
+// exactly what CreateDangerField would give; otherwise the window is not Certified.
+constexpr int DangerWindowInnerRadius = 1;  // a search node only reads danger next to its own head
+constexpr int DangerWindowMaxMargin = 6;
+constexpr int DangerWindowMargins[] = {1, 3, DangerWindowMaxMargin};  // widened until certified
+constexpr int DangerWindowInnerSize = 2 * DangerWindowInnerRadius + 1;
+constexpr int DangerWindowMaxSize = 2 * (DangerWindowInnerRadius + DangerWindowMaxMargin) + 3;
+
+struct DangerWindow {
+    bool Certified;
+    Point Center;
+    DangerValue Values[DangerWindowInnerSize][DangerWindowInnerSize];
+
+    DangerValue At(int h, int w) const {
+        return Values[h - Center.h + DangerWindowInnerRadius][w - Center.w + DangerWindowInnerRadius];
+    }
+};
+
+// Certified windows keyed by a hash of everything their propagation reads: the sources of the
+// square around the center, taken relative to it, so the same local pattern met at another node,
+// tick or place on the board is not recomputed. Uncertified results are kept too, which lets a
+// repeated pattern go straight to the next margin.
+constexpr int DangerPatternCacheBits = 16;
+
+class DangerPatternCache {
+    struct Entry {
+        uint64_t Key;  // 0 marks an empty slot
+        bool Certified;
+        DangerValue Values[DangerWindowInnerSize][DangerWindowInnerSize];
+    };
+    std::unique_ptr<Entry[]> entries = std::make_unique<Entry[]>(1 << DangerPatternCacheBits);
+
+   public:
+    long long Lookups = 0;
+    long long Hits = 0;
+
+    const Entry* Find(uint64_t key) {
+        Lookups++;
+        const Entry& entry = entries[key & ((1 << DangerPatternCacheBits) - 1)];
+        if (entry.Key != key) {
+            return nullptr;
+        }
+        Hits++;
+        return &entry;
+    }
+
+    void Store(uint64_t key, const DangerWindow& window) {
+        Entry& entry = entries[key & ((1 << DangerPatternCacheBits) - 1)];
+        entry.Key = key;
+        entry.Certified = window.Certified;
+        std::copy(&window.Values[0][0], &window.Values[0][0] + DangerWindowInnerSize * DangerWindowInnerSize, &entry.Values[0][0]);
+    }
+};
+
+thread_local DangerPatternCache DangerPatterns;
+
+// Cells an opponent's head can step on next tick, unless the danger spreads from them anyway.
+void ApplyHeadToHeadDanger(const Game& game, DangerWindow& window) {
+    const DangerValue head_to_head_danger = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain * PenaltyDeclineOfHeadToHeadDeath);
+    const Point center = window.Center;
+    for (const SnakeInfo& snake : game.SnakeInfos) {
+        if (!snake.Alive || snake.Idx == game.SelfIdx) {
+            continue;
+        }
+        for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+            const int h_next = snake.Body.front().h + DhOfOperation(direction);
+            const int w_next = snake.Body.front().w + DwOfOperation(direction);
+            if (direction == Reverse(snake.LastOperation) || h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width ||
+                std::abs(h_next - center.h) > DangerWindowInnerRadius || std::abs(w_next - center.w) > DangerWindowInnerRadius) {
+                continue;
+            }
+            window.Values[h_next - center.h + DangerWindowInnerRadius][w_next - center.w + DangerWindowInnerRadius] = head_to_head_danger;
+        }
+    }
+}
+
+DangerWindow CreateDangerWindow(Game& game, Point center) {
+    const PhaseScope phase(Phase::Fields);
+    const DangerValue death_danger = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain);
+    const DangerValue head_to_head_danger = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain * PenaltyDeclineOfHeadToHeadDeath);
+    const bool i_have_shield = game.SnakeInfos[game.SelfIdx].ShieldET > 0;
+    const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+    // nothing in the widest window is further from its center, or from the head, than this
+    const int window_extent = 2 * (DangerWindowInnerRadius + DangerWindowMaxMargin + 1);
+    const VacateIndex vacate(game, std::abs(center.h - head.h) + std::abs(center.w - head.w) + window_extent, center, window_extent);
+    // no danger can be lower than the lowest source
+    const DangerValue lowest_danger = std::min({QuantizeDanger(ValueOfTrap), death_danger, QuantizeDanger(ValueOfOpponentWhenHaveShield), head_to_head_danger});
+    // below every quantized danger, so it marks cells off the map
+    constexpr DangerValue OffMap = INT16_MIN;
+
+    DangerWindow window;
+    window.Certified = false;
+    window.Center = center;
+    for (int margin : DangerWindowMargins) {
+        const int radius = DangerWindowInnerRadius + margin;
+        const int size = 2 * radius + 3;  // the window plus a ring of pinned cells
+        const int top = center.h - radius - 1;
+        const int left = center.w - radius - 1;
+        DangerValue sources[DangerWindowMaxSize * DangerWindowMaxSize];
+        for (int lh = 0; lh < size; lh++) {
+            for (int lw = 0; lw < size; lw++) {
+                const int h = top + lh, w = left + lw;
+                const bool off_map = h < 0 || h >= Height || w < 0 || w >= Width;
+                sources[lh * size + lw] = off_map ? OffMap : DangerSourceValue(game, h, w, i_have_shield, head, vacate);
+            }
+        }
+        if (EnableSpreadableDangerAroundOpponentHead) {
+            for (const SnakeInfo& snake : game.SnakeInfos) {
+                if (!snake.Alive || snake.Idx == game.SelfIdx) {
+                    continue;
+                }
+                for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+                    const int lh = snake.Body.front().h + DhOfOperation(direction) - top;
+                    const int lw = snake.Body.front().w + DwOfOperation(direction) - left;
+                    if (direction == Reverse(snake.LastOperation) || lh <= 0 || lw <= 0 || lh >= size - 1 || lw >= size - 1 ||
+                        top + lh >= Height || left + lw >= Width || top + lh < 0 || left + lw < 0) {
+                        continue;
+                    }
+                    sources[lh * size + lw] = head_to_head_danger;
+                }
+            }
+        }
+
+        uint64_t key = Mix64(((uint64_t)margin << 32) | ((uint64_t)(uint16_t)death_danger << 16) | (uint16_t)lowest_danger);
+        for (int local_idx = 0; local_idx < size * size; local_idx++) {
+            if (sources[local_idx] != NoDanger) {
+                key ^= Mix64(((uint64_t)local_idx << 16) | (uint16_t)sources[local_idx]);
+            }
+        }
+        key |= 1;
+        if (const auto* entry = DangerPatterns.Find(key)) {
+            if (!entry->Certified) {
+                continue;
+            }
+            std::copy(&entry->Values[0][0], &entry->Values[0][0] + DangerWindowInnerSize * DangerWindowInnerSize, &window.Values[0][0]);
+            window.Certified = true;
+            break;
+        }
+
+        DangerValue bounds[2][DangerWindowMaxSize * DangerWindowMaxSize];
+        for (int bound = 0; bound < 2; bound++) {
+            const bool upper = bound == 0;
+            DangerValue* values = bounds[bound];
+            // ring buffer of cells to relax; a cell already waiting is not queued twice
+            int queue[DangerWindowMaxSize * DangerWindowMaxSize];
+            bool queued[DangerWindowMaxSize * DangerWindowMaxSize] = {};
+            int queue_head = 0, queue_size = 0;
+            const int capacity = size * size;
+            auto push = [&](int local_idx) {
+                if (!queued[local_idx]) {
+                    queued[local_idx] = true;
+                    queue[(queue_head + queue_size++) % capacity] = local_idx;
+                }
+            };
+            for (int lh = 0; lh < size; lh++) {
+                for (int lw = 0; lw < size; lw++) {
+                    const int local_idx = lh * size + lw;
+                    if (sources[local_idx] == OffMap) {
+                        values[local_idx] = death_danger;
+                        continue;
+                    }
+                    const bool in_ring = lh == 0 || lw == 0 || lh == size - 1 || lw == size - 1;
+                    values[local_idx] = (in_ring && !upper) ? lowest_danger : sources[local_idx];
+                    if (values[local_idx] != NoDanger) {
+                        push(local_idx);
+                    }
+                }
+            }
+            while (queue_size > 0) {
+                const int current = queue[queue_head];
+                queued[current] = false;
+                queue_head = (queue_head + 1) % capacity;
+                queue_size--;
+                for (int next : {current - 1, current + 1, current - size, current + size}) {
+                    const int lh = next / size, lw = next % size;
+                    if (next < 0 || next >= size * size || lh == 0 || lw == 0 || lh == size - 1 || lw == size - 1 ||
+                        std::abs(lw - current % size) > 1 || sources[next] == OffMap) {
+                        continue;
+                    }
+                    const DangerValue danger_left = values[next - 1];
+                    const DangerValue danger_right = values[next + 1];
+                    const DangerValue danger_up = values[next - size];
+                    const DangerValue danger_down = values[next + size];
+                    const DangerValue danger = std::min({
+                        std::max({danger_left, danger_right, danger_up}),
+                        std::max({danger_left, danger_right, danger_down}),
+                        std::max({danger_left, danger_up, danger_down}),
+                        std::max({danger_right, danger_up, danger_down}),
+                    });
+                    if (danger < values[next]) {
+                        values[next] = danger;
+                        push(next);
+                    }
+                }
+            }
+        }
+
+        bool agree = true;
+        for (int dh = -DangerWindowInnerRadius; dh <= DangerWindowInnerRadius && agree; dh++) {
+            for (int dw = -DangerWindowInnerRadius; dw <= DangerWindowInnerRadius; dw++) {
+                const int local_idx = (radius + 1 + dh) * size + (radius + 1 + dw);
+                if (bounds[0][local_idx] != bounds[1][local_idx]) {
+                    agree = false;
+                    break;
+                }
+                window.Values[dh + DangerWindowInnerRadius][dw + DangerWindowInnerRadius] = bounds[0][local_idx];
+            }
+        }
+        window.Certified = agree;
+        DangerPatterns.Store(key, window);
+        if (agree) {
+            break;
+        }
+    }
+
+    if (window.Certified && !EnableSpreadableDangerAroundOpponentHead) {
+        ApplyHeadToHeadDanger(game, window);
+    }
+    return window;
+}
+
+// Traps, and opponents' bodies we cannot reach before they have moved on.
+bool BlocksDistance(const Game& game, const VacateIndex& vacate, int idx) {
+    const int h = idx / Width, w = idx % Width;
+    const Cell& cell = game.Map[h][w];
+    if (cell.Obj == Trap) {
+        return true;
+    }
+    const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+    return cell.SnakeIdx != EmptyIdx && cell.SnakeIdx != game.SelfIdx && !vacate.FreeBy(h, w, std::abs(h - head.h) + std::abs(w - head.w));
+}
+
+// A plain BFS: every tick starts in a fresh process, where building a terrain row and
+// repairing it for bodies costs about twice as much as searching once.
+Field<int> CreateDistanceField(Game& game, Point point, const VacateIndex& vacate) {
+    Field<int> DistanceField(-1);
+    int* distances = DistanceField[0];
+    int queue[CellCount];
+    int queue_head = 0, queue_tail = 0;
+    const int source = CellIdxOf(point.h, point.w);
+    distances[source] = 0;
+    queue[queue_tail++] = source;
+    while (queue_head < queue_tail) {
+        const int current = queue[queue_head++];
+        int neighbors[4];
+        const int neighbor_cnt = NeighborCellIdxs(current, neighbors);
+        for (int i = 0; i < neighbor_cnt; i++) {
+            const int next = neighbors[i];
+            if (distances[next] != -1 || game.Map[next / Width][next % Width].Obj == Wall || BlocksDistance(game, vacate, next)) {
+                continue;
+            }
+            distances[next] = distances[current] + 1;
+            queue[queue_tail++] = next;
+        }
+    }
+    return DistanceField;
+}
+
+// With EnableSectorObjectDistances, distances come from SectorDistances, which must be synced.
+Field<double> CreateSpreadableField(Game& game, Point point, double spreadable_value, const VacateIndex& vacate) {
+    Field<int> DistanceField;
+    if constexpr (EnableSectorObjectDistances) {
+        SectorDistances.DistancesFrom(point, DistanceField[0]);
+    } else {
+        DistanceField = CreateDistanceField(game, point, vacate);
+    }
+    return DistanceField.Map([spreadable_value](int distance) {
+        if (distance == -1) {
+            return 0.0;
+        }
+        return spreadable_value / (distance + 1);
+    });
+}
+
+// Objects worth heading for and their spreadable values, leaving out those in danger.
+std::vector<std::pair<Point, double>> ObjectSources(const Game& game, const Field<DangerValue>& DangerField) {
+    std::vector<std::pair<Point, double>> RawObjects;
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            double spreadable_value = 0;
+            Cell cell = game.Map[h][w];
+            if (DangerField[h][w] < 0)
+                continue;
+            if (cell.Obj > ScoreZero && cell.Obj < ScoreTooLarge) {
+                spreadable_value = BaseValueOfScore + ValuePerScore * (cell.Obj - ScoreZero);
+            }
+            if (cell.Obj == Length) {
+                spreadable_value = ValueOfLengthAtBegin * (double)game.TimeRemain / TotalTime + ValueOfLengthAtEnd * (1 - (double)game.TimeRemain / TotalTime);
+            }
+            if (spreadable_value != 0) {
+                RawObjects.push_back({{.h = h, .w = w}, spreadable_value});
+            }
+        }
+    }
+    return RawObjects;
+}
+
+// Syncs this thread's SectorDistances with `game`, unless it already is.
+void SyncSectorDistances(const Game& game, const VacateIndex& vacate) {
+    thread_local uint64_t synced_position = 0;
+    const uint64_t position = game.PositionHash() | 1;
+    if (position != synced_position) {
+        SectorDistances.Sync([&](int idx) { return game.Map[idx / Width][idx % Width].Obj == Wall || BlocksDistance(game, vacate, idx); });
+        synced_position = position;
+    }
+}
+
+// Weighs the spreadable field of every object, in the order of `RawObjects`, and keeps the best
+// weighted value of each cell.
+Field<double> CombineObjectFields(const Game& game,
+                                  const std::vector<std::pair<Point, double>>& RawObjects,
+                                  const std::vector<Field<double>>& RawObjectFields,
+                                  const Field<int>& CenterDistanceField,
+                                  const Territory& territory) {
+    const int my_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
+    const int my_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
+    Field<double> SumField(0);
+    for (auto& Field : RawObjectFields) {
+        SumField = SumField + Field;
+    }
+    Field<double> StandardlizedSumField = SumField.Standardlize(1.0);
+
+    Field<double> ObjectValueField(0);
+    for (int object_idx = 0; object_idx < (int)RawObjectFields.size(); object_idx++) {
+        auto& Field = RawObjectFields[object_idx];
+        const auto [object_point, spreadable_value] = RawObjects[object_idx];
+        double field_weight = 1.0;
+        double field_value_at_my_pos = Field[my_h][my_w];
+        field_weight *= std::pow(field_value_at_my_pos / (SumField[my_h][my_w] / RawObjectFields.size()), LockOnCoefficient);
+        field_weight *= StandardlizedSumField[my_h][my_w];
+        field_weight *= 1.0 - DeclineOfObjectValueAtEdge * (double)CenterDistanceField[my_h][my_w] / RadiusOfMap;
+        if constexpr (EnableTerritoryCompetitivity) {
+            // an opponent owns the object and gets there before us even with our body out of the way
+            const int object_idx_on_map = CellIdxOf(object_point.h, object_point.w);
+            const int owner = territory.Owner[object_idx_on_map];
+            if (owner >= 0 && owner != game.SelfIdx) {
+                double field_value_at_opponent_arrival = spreadable_value / (territory.Arrival[object_idx_on_map] + 1);
+                if (field_value_at_opponent_arrival > field_value_at_my_pos) {
+                    field_weight *= BaseDeclineOfCompetitivity * (field_value_at_my_pos / field_value_at_opponent_arrival);
+                }
+            }
+        } else {
+            for (const SnakeInfo& snake : game.SnakeInfos) {
+                if (!snake.Alive || snake.Idx == game.SelfIdx) {
+                    continue;
+                }
+                double field_value_at_opponent_pos = Field[snake.Body.front().h][snake.Body.front().w];
+                if (field_value_at_opponent_pos >= field_value_at_my_pos) {
+                    field_weight *= BaseDeclineOfCompetitivity * (field_value_at_my_pos / field_value_at_opponent_pos);
+                }
+            }
+        }
+        ObjectValueField = ObjectValueField.MaxWith(Field * field_weight);
+    }
+    ObjectValueField = ObjectValueField * CorrectionForSpreadableFields;
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            Cell cell = game.Map[h][w];
+            if (cell.Obj == Trap) {
+                ObjectValueField[h][w] += ValueOfTrap;
+            }
+        }
+    }
+    return ObjectValueField;
+}
+
+// The value of being near the center, from the distances to the center the root fields share.
+Field<double> CreateCenterValueField(const Game& game, const Field<int>& CenterDistanceField) {
+    const int tick = TotalTime - game.TimeRemain;
+    const double time_percentage = ((double)tick - TickCenterValueBegin) / (TickCenterValueEnd - TickCenterValueBegin);
+    const double ValueOfCenter = time_percentage * ValueOfCenterAtEnd + (1 - time_percentage) * ValueOfCenterWhenEmerge;
+    Field<double> CenterValueField;
+    const int radius_of_center = 5;
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            int radius = CenterDistanceField[h][w];
+            double value = radius <= radius_of_center ? (ValueOfCenter + ValueOnlyInCenter) : ValueOfCenter * ((double)radius - RadiusOfMap) / (radius_of_center - RadiusOfMap);
+            CenterValueField[h][w] = value;
+        }
+    }
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            const int longer = std::max(std::abs(h - CenterH), std::abs(w - CenterW));
+            const int shorter = std::min(std::abs(h - CenterH), std::abs(w - CenterW));
+            bool in_center = (longer <= 5 && shorter <= 2) || (longer <= 4 && shorter <= 4);
+            if (in_center) {
+                CenterValueField[h][w] = ValueOfCenter + ValueOnlyInCenter;
+            }
+        }
+    }
+    return CenterValueField;
+}
+
+// The value field capped by the danger, as the search reads it.
+Field<double> CapValueByDanger(const Field<double>& ValueFieldWithoutDangerField, const Field<DangerValue>& DangerField) {
+    const PhaseScope phase(Phase::Fields);
+    Field<double> ValueField;
+    const double* value = ValueFieldWithoutDangerField[0];
+    const DangerValue* danger = DangerField[0];
+    double* result = ValueField[0];
+    for (int idx = 0; idx < Height * Width; idx++) {
+        result[idx] = std::min(value[idx], DangerToValue(danger[idx]));
+    }
+    return ValueField;
+}
+
+struct ValueFields {
+    Field<DangerValue> DangerField;
+    Field<double> ValueFieldWithoutDangerField;
+};
+
+// The root fields of a tick, built as a task graph on `thread_cnt` threads: the danger field, the
+// distances from the center and the territory (when used) are independent, the center value
+// field follows the distances, and once the danger is known each object's spreadable field is a
+// task of its own. The fields are the same for any thread count.
+ValueFields CreateValueFields(Game& game, int thread_cnt = 1) {
+    const PhaseScope phase(Phase::Fields);
+    const int tick = TotalTime - game.TimeRemain;
+    const VacateIndex vacate(game, Height + Width);
+    Field<DangerValue> DangerField;
+    Field<double> CenterValueField(0);
+    Field<int> CenterDistanceField;
+    Territory territory;  // only read by CombineObjectFields with EnableTerritoryCompetitivity
+    std::vector<std::pair<Point, double>> RawObjects;
+    std::vector<Field<double>> RawObjectFields;
+
+    TaskGraph graph;
+    const int danger_task = graph.Add([&]() { DangerField = CreateDangerField(game); });
+    const int center_distance_task =
+        graph.Add([&]() { CenterDistanceField = CreateDistanceField(game, {.h = CenterH, .w = CenterW}, vacate); });
+    if (tick >= TickCenterValueBegin && tick <= TickCenterValueEnd) {
+        graph.Add([&]() { CenterValueField = CreateCenterValueField(game, CenterDistanceField); }, {center_distance_task});
+    }
+    if constexpr (EnableTerritoryCompetitivity) {
+        graph.Add([&]() { territory = CreateTerritory(game); });
+    }
+    graph.Add(
+        [&]() {
+            RawObjects = ObjectSources(game, DangerField);
+            RawObjectFields.resize(RawObjects.size());
+            for (int object_idx = 0; object_idx < (int)RawObjects.size(); object_idx++) {
+                graph.Add([&, object_idx]() {
+                    const PhaseScope phase(Phase::Fields);
+                    if constexpr (EnableSectorObjectDistances) {
+                        SyncSectorDistances(game, vacate);
+                    }
+                    const auto [object_point, spreadable_value] = RawObjects[object_idx];
+                    RawObjectFields[object_idx] = CreateSpreadableField(game, object_point, spreadable_value, vacate);
+                });
+            }
+        },
+        {danger_task});
+    graph.Run(thread_cnt);
+
+    Field<double> ObjectValueField = CombineObjectFields(game, RawObjects, RawObjectFields, CenterDistanceField, territory);
+    Field<double> ValueFieldWithoutDangerField = ObjectValueField + CenterValueField;
+
+    if constexpr (LogEnabled<LogDebug>) {
+        const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+        LogLine<LogDebug> dump;
+        dump.Stream() << "Danger Field:\n";
+        DangerField.Map(DangerToValue).PrintValuesNearby(dump.Stream(), head, 3);
+        dump.Stream() << "Object Value Field:\n";
+        ObjectValueField.PrintValuesNearby(dump.Stream(), head, 3);
+        dump.Stream() << "Center Value Field:\n";
+        CenterValueField.PrintValuesNearby(dump.Stream(), head, 3);
+        dump.Stream() << "Value Field Without Danger Field:\n";
+        ValueFieldWithoutDangerField.PrintValuesNearby(dump.Stream(), head, 3);
+        dump.Stream() << "Map:\n";
+        game.PrintMapNearby(dump.Stream(), head, 10);
+    }
+
+    return {.DangerField = std::move(DangerField), .ValueFieldWithoutDangerField = std::move(ValueFieldWithoutDangerField)};
+}
+
+//
+//  Neural Danger
+//
+
+// A small quantized network predicting the danger window around our head from the danger sources
+// nearby, an alternative to solving the window. The stencil only takes mins and maxes, so every
+// danger is one of the source values and each inner cell is classified as one of them; the
+// head-to-head danger is then applied exactly as CreateDangerWindow does.
+//
+// Inputs are one-hot planes over a square around the head, so the hidden layer is a sum of the
+// weight rows of the few active inputs, int16 weights scaled by 127 summed in int32, followed by
+// a clipped ReLU into int8 and an int8 output layer. The accumulator is rebuilt for every node
+// rather than updated as ImagineOperations moves cells: the inputs are relative to the head, which
+// moves every tick and shifts all of them, and a rebuild over the active inputs is already cheap.
+// The fixed sizes let GCC vectorize both layers.
+constexpr uint32_t NetMagic = 0x544E4E53;  // "SNNT"
+constexpr uint16_t NetVersion = 1;
+constexpr int NetRadius = 5;
+constexpr int NetSize = 2 * NetRadius + 1;
+constexpr int NetPlanes = 3;  // deadly (off the map, wall, opponent), trap, opponent while we have a shield
+constexpr int NetInputs = NetPlanes * NetSize * NetSize;
+constexpr int NetHidden = 32;
+constexpr int NetClasses = 4;  // no danger, then one per plane
+constexpr int NetCells = DangerWindowInnerSize * DangerWindowInnerSize;
+constexpr int NetOutputs = NetCells * NetClasses;
+constexpr int NetHiddenScale = 127;  // an activation of 1 in the int8 hidden layer
+constexpr int NetOutputScale = 64;   // of the int8 output weights
+
+struct NetHeader {
+    uint32_t Magic;
+    uint16_t Version;
+    uint8_t Radius;
+    uint8_t Hidden;
+};
+
+struct NetWeights {
+    int16_t InputWeights[NetInputs][NetHidden];
+    int16_t HiddenBiases[NetHidden];
+    int8_t OutputWeights[NetOutputs][NetHidden];
+    int32_t OutputBiases[NetOutputs];
+};
+
+// The danger each class stands for at this tick.
+void NetClassDangers(const Game& game, DangerValue (&dangers)[NetClasses]) {
+    dangers[0] = NoDanger;
+    dangers[1] = QuantizeDanger(ValueOfDeathPerRemainTime * game.TimeRemain);
+    dangers[2] = QuantizeDanger(ValueOfTrap);
+    dangers[3] = QuantizeDanger(ValueOfOpponentWhenHaveShield);
+}
+
+// Writes the indices of the active inputs for a window centered on our head and returns how many.
+int NetFeatures(const Game& game, int* features) {
+    const bool i_have_shield = game.SnakeInfos[game.SelfIdx].ShieldET > 0;
+    const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+    const VacateIndex vacate(game, 2 * NetRadius, head, NetRadius);
+    int feature_cnt = 0;
+    for (int lh = 0; lh < NetSize; lh++) {
+        for (int lw = 0; lw < NetSize; lw++) {
+            const int h = head.h + lh - NetRadius, w = head.w + lw - NetRadius;
+            int plane;
+            if (h < 0 || h >= Height || w < 0 || w >= Width || game.Map[h][w].Obj == Wall) {
+                plane = 0;
+            } else if (game.Map[h][w].Obj == Trap) {
+                plane = 1;
+            } else if (DangerSourceValue(game, h, w, i_have_shield, head, vacate) != NoDanger) {
+                plane = i_have_shield ? 2 : 0;
+            } else {
+                continue;
+            }
+            features[feature_cnt++] = (plane * NetSize + lh) * NetSize + lw;
+        }
+    }
+    return feature_cnt;
+}
+
+class NeuralDanger {
+    std::unique_ptr<NetWeights> weights;
+
+   public:
+    // Reports and returns false if the file is missing or was written for another shape.
+    bool Load(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+            Log<LogError>() << "Cannot open net " << path;
+            return false;
+        }
+        NetHeader header;
+        auto loaded = std::make_unique<NetWeights>();
+        const bool ok = fread(&header, sizeof(header), 1, file) == 1 && header.Magic == NetMagic && header.Version == NetVersion &&
+                        header.Radius == NetRadius && header.Hidden == NetHidden && fread(loaded.get(), sizeof(NetWeights), 1, file) == 1;
+        fclose(file);
+        if (!ok) {
+            Log<LogError>() << "Ignoring malformed net " << path;
+            return false;
+        }
+        weights = std::move(loaded);
+        return true;
+    }
+
+    static bool Save(const char* path, const NetWeights& weights) {
+        FILE* file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+        const NetHeader header{.Magic = NetMagic, .Version = NetVersion, .Radius = NetRadius, .Hidden = NetHidden};
+        const bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&weights, sizeof(weights), 1, file) == 1;
+        return fclose(file) == 0 && ok;
+    }
+
+    // Predicted class of every inner cell, row by row.
+    static void Classify(const NetWeights& weights, const int* features, int feature_cnt, int (&classes)[NetCells]) {
+        // up to NetInputs rows of int16 weights may be active, which int16 cannot sum without wrapping
+        int32_t accumulator[NetHidden];
+        std::copy(weights.HiddenBiases, weights.HiddenBiases + NetHidden, accumulator);
+        for (int i = 0; i < feature_cnt; i++) {
+            const int16_t* row = weights.InputWeights[features[i]];
+            for (int j = 0; j < NetHidden; j++) {
+                accumulator[j] += row[j];
+            }
+        }
+        int8_t hidden[NetHidden];
+        for (int j = 0; j < NetHidden; j++) {
+            hidden[j] = (int8_t)std::clamp<int32_t>(accumulator[j], 0, NetHiddenScale);
+        }
+        for (int cell = 0; cell < NetCells; cell++) {
+            int best_logit = INT_MIN;
+            for (int c = 0; c < NetClasses; c++) {
+                const int8_t* row = weights.OutputWeights[cell * NetClasses + c];
+                int logit = weights.OutputBiases[cell * NetClasses + c];
+                for (int j = 0; j < NetHidden; j++) {
+                    logit += hidden[j] * row[j];
+                }
+                if (logit > best_logit) {
+                    best_logit = logit;
+                    classes[cell] = c;
+                }
+            }
+        }
+    }
+
+    // The danger window around our head, always Certified as there is nothing to fall back to.
+    DangerWindow Window(const Game& game) const {
+        const PhaseScope phase(Phase::Fields);
+        int features[NetInputs];
+        const int feature_cnt = NetFeatures(game, features);
+        int classes[NetCells];
+        Classify(*weights, features, feature_cnt, classes);
+        DangerValue dangers[NetClasses];
+        NetClassDangers(game, dangers);
+
+        DangerWindow window;
+        window.Certified = true;
+        window.Center = game.SnakeInfos[game.SelfIdx].Body.front();
+        for (int cell = 0; cell < NetCells; cell++) {
+            const int h = window.Center.h + cell / DangerWindowInnerSize - DangerWindowInnerRadius;
+            const int w = window.Center.w + cell % DangerWindowInnerSize - DangerWindowInnerRadius;
+            const bool off_map = h < 0 || h >= Height || w < 0 || w >= Width;
+            window.Values[cell / DangerWindowInnerSize][cell % DangerWindowInnerSize] = off_map ? dangers[1] : dangers[classes[cell]];
+        }
+        if (!EnableSpreadableDangerAroundOpponentHead) {
+            ApplyHeadToHeadDanger(game, window);
+        }
+        return window;
+    }
+};
+
+const NeuralDanger* LoadedNet = nullptr;  // set by --net or SNAKE_NET; search nodes use it instead of solving windows
+
+//
+//  DFS Search
+//
+
+constexpr int SearchNodesPerClockCheck = 16;
+
+// Selective depth. A case is contested if an opponent's head is this close to our new head or if
+// every cell we can step on next is this close to death; its children are searched one move
+// deeper, at most MaxSearchExtensions times along a path. A case is quiet if no opponent is in
+// the gambling radius and we can step on a cell without danger; its children after the first
+// are searched one move shallower, and again at full depth if they come out best so far.
+constexpr int SearchExtensionRadius = 2;
+constexpr double SearchExtensionDeathRatio = 0.5;
+constexpr int MaxSearchExtensions = 2;
+constexpr int MinReducedChildDepth = 1;  // reduced children keep at least this depth
+
+// Per-ply scratch space of the search, reused by every node at that place on the path.
+struct MoveBuffer {
+    std::vector<int> GamblingSnakeIdxs;
+    std::vector<Operation> Candidates;  // AllOperationCount slots per gambling snake
+    std::vector<int> CandidateCnts;
+    std::vector<int> EnumerateStack;
+    std::vector<SnakeIdxAndOperation> Cases;  // snake_cnt operations per case, sorted by Idx
+};
+
+// Writes every combination of sensible operations of the gambling snakes into `buffer.Cases`,
+// with our `operation` and the last operation of everyone else. An opponent's operation is left
+// out if it is illegal or certain death, unless all of them are, so the simulation stays honest.
+// Returns the number of cases.
+int GenerateCases(const Game& game, Operation operation, MoveBuffer& buffer) {
+    const int snake_cnt = game.SnakeInfos.size();
+    const int gambling_snake_cnt = buffer.GamblingSnakeIdxs.size();
+    buffer.Candidates.resize(gambling_snake_cnt * AllOperationCount);
+    buffer.CandidateCnts.assign(gambling_snake_cnt, 0);
+    buffer.EnumerateStack.assign(gambling_snake_cnt, 0);
+    Operation* candidates = buffer.Candidates.data();
+    int* candidate_cnts = buffer.CandidateCnts.data();
+    int* enumerate_stack = buffer.EnumerateStack.data();
+    int case_cnt = 1;
+    for (int i = 0; i < gambling_snake_cnt; i++) {
+        const SnakeInfo& snake = game.SnakeInfos[buffer.GamblingSnakeIdxs[i]];
+        for (Operation op : AllOperations) {
+            if (op == Reverse(snake.LastOperation) || (op == Shield && snake.Score <= ShieldCost) || game.IsCertainDeath(snake.Idx, op)) {
+                continue;
+            }
+            candidates[i * AllOperationCount + candidate_cnts[i]++] = op;
+        }
+        if (candidate_cnts[i] == 0) {
+            candidates[i * AllOperationCount + candidate_cnts[i]++] = snake.LastOperation;
+        }
+        case_cnt *= candidate_cnts[i];
+    }
+
+    buffer.Cases.resize(case_cnt * snake_cnt);
+    SnakeIdxAndOperation* row = buffer.Cases.data();
+    for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
+        row[snake_idx] = {.Idx = snake_idx, .Op = snake_idx == game.SelfIdx ? operation : game.SnakeInfos[snake_idx].LastOperation};
+    }
+    for (int case_idx = 0; case_idx < case_cnt; case_idx++) {
+        row = buffer.Cases.data() + case_idx * snake_cnt;
+        if (case_idx > 0) {
+            std::copy(row - snake_cnt, row, row);
+        }
+        for (int i = 0; i < gambling_snake_cnt; i++) {
+            row[buffer.GamblingSnakeIdxs[i]].Op = candidates[i * AllOperationCount + enumerate_stack[i]];
+        }
+
+        // next
+        int i = gambling_snake_cnt - 1;
+        while (i >= 0 && enumerate_stack[i] == candidate_cnts[i] - 1) {
+            enumerate_stack[i] = 0;
+            i--;
+        }
+        if (i >= 0) {
+            enumerate_stack[i]++;
+        }
+    }
+    return case_cnt;
+}
+
+// Key of a search node: the position reached, the operation we try in it, the depth left and the
+// extensions still allowed below it, which change what the depth left may grow to. Bodies enter
+// through the map cells and their two ends, which leaves their order inside a crowded cell set
+// ambiguous; the table is lossy anyway.
+uint64_t SearchNodeKey(const Game& game, Operation operation, int node_depth, int extensions_left) {
+    uint64_t key = game.MapHash ^ Mix64(((uint64_t)game.TimeRemain << 40) | ((uint64_t)extensions_left << 36) |
+                                        ((uint64_t)(operation + 1) << 32) | (uint32_t)node_depth);
+    for (const SnakeInfo& snake : game.SnakeInfos) {
+        const Point head = snake.Body.front(), tail = snake.Body.back();
+        key ^= Mix64(((uint64_t)snake.Idx << 48) | ((uint64_t)snake.Alive << 47) | ((uint64_t)(snake.LastOperation + 1) << 44) |
+                     ((uint64_t)(head.h * Width + head.w) << 32) | ((uint64_t)(tail.h * Width + tail.w) << 20) | snake.Body.size());
+        key ^= Mix64(((uint64_t)snake.Idx << 48) | ((uint64_t)(uint32_t)snake.Score << 16) | (snake.ShieldCD << 8) | snake.ShieldET);
+    }
+    return key;
+}
+
+// Node utilities shared by the threads of one decision. Lossy: a store overwrites whatever is in
+// its slot. Lock-free: an entry holds the utility and the key XOR the utility, so an entry torn
+// by two threads writing at once fails the check instead of answering for the wrong node.
+constexpr int SharedUtilityTableBits = 18;
+
+class SharedUtilityTable {
+    struct Entry {
+        std::atomic<uint64_t> Check{0};
+        std::atomic<uint64_t> Data{0};
+    };
+    std::unique_ptr<Entry[]> entries = std::make_unique<Entry[]>(1 << SharedUtilityTableBits);
+
+    Entry& Slot(uint64_t key) { return entries[key >> (64 - SharedUtilityTableBits)]; }
+
+   public:
+    std::optional<double> Find(uint64_t key) {
+        Entry& entry = Slot(key);
+        const uint64_t data = entry.Data.load(std::memory_order_relaxed);
+        if ((entry.Check.load(std::memory_order_relaxed) ^ data) != key) {
+            return std::nullopt;
+        }
+        return std::bit_cast<double>(data);
+    }
+
+    void Store(uint64_t key, double utility) {
+        Entry& entry = Slot(key);
+        const uint64_t data = std::bit_cast<uint64_t>(utility);
+        entry.Data.store(data, std::memory_order_relaxed);
+        entry.Check.store(key ^ data, std::memory_order_relaxed);
+    }
+};
+
+struct SearchContext {
+    std::chrono::system_clock::time_point ShouldFinishBefore;
+    long long MaxNodes = LLONG_MAX;  // node budget; with no deadline the search is deterministic
+    long long Nodes = 0;
+    SharedUtilityTable* Table = nullptr;     // finished nodes of every thread, if searching in parallel
+    const std::atomic<bool>* Stop = nullptr;  // set once the decision no longer needs this search
+    int MoveOrderShift = 0;                   // rotates the order our operations are tried in
+    const NeuralDanger* Net = LoadedNet;      // predicts the danger windows, if loaded
+    long long TableHits = 0;
+    long long DangerWindows = 0;          // per-node danger computed in a window
+    long long DangerWindowFallbacks = 0;  // window not certified, full field computed instead
+    long long Extensions = 0, Reductions = 0, ReSearches = 0;
+    std::vector<MoveBuffer> MoveBuffers;  // indexed by the node's place on the path
+
+    // Counts a node unless the node budget or the deadline is used up. The clock is only read
+    // every few nodes, which costs at most a few node times of overrun.
+    bool TryVisit() {
+        if (Nodes >= MaxNodes || (Stop && Stop->load(std::memory_order_relaxed))) {
+            return false;
+        }
+        if ((Nodes + 1) % SearchNodesPerClockCheck == 0 && std::chrono::high_resolution_clock::now() > ShouldFinishBefore) {
+            return false;
+        }
+        Nodes++;
+        return true;
+    }
+};
+
+// Value field a search node hands to its children: the value field without danger capped by the
+// danger after the node's moves. Children only read it next to their new head, so the danger
+// may come from a window around the node's head instead of a full field.
+class ValueView {
+   private:
+    const Field<double>& WithoutDanger;
+    const Field<DangerValue>* DangerField;
+    const DangerWindow* Window;
+
+   public:
+    ValueView(const Field<double>& without_danger, const Field<DangerValue>& danger)
+        : WithoutDanger(without_danger), DangerField(&danger), Window(nullptr) {}
+    ValueView(const Field<double>& without_danger, const DangerWindow& window)
+        : WithoutDanger(without_danger), DangerField(nullptr), Window(&window) {}
+
+    double Danger(int h, int w) const { return DangerToValue(DangerField ? (*DangerField)[h][w] : Window->At(h, w)); }
+    double Value(int h, int w) const { return std::min(WithoutDanger[h][w], Danger(h, w)); }
+
+    void PrintValuesNearby(std::ostream& out, Point point, int radius) const {
+        if (!DangerField) {
+            out << "(windowed danger, not printable)\n";
+            return;
+        }
+        CapValueByDanger(WithoutDanger, *DangerField).PrintValuesNearby(out, point, radius);
+    }
+};
+
+// One iteration of the depth-limited search over our moves, run on an explicit stack with a frame
+// per node of the current path. A node takes the worst case over the opponents' operations of
+// its immediate utility plus the declined best utility of our next moves.
+// Run() stops when the budget in the context is used up and pauses: every imagined move is
+// revoked, so the game is at the root position again. Calling Run() again, for example after
+// raising the budget, re-imagines the path and resumes where it stopped.
+class MoveSearch {
+   private:
+    struct Frame {
+        Operation Op;
+        int Ply;         // frames above this one on the path
+        int Depth;       // of our moves left to search below this node
+        int Extensions;  // along the path to this node
+        const ValueView* ValueField;
+        int CaseCnt, CaseIdx;
+        double MinUtility;
+        uint64_t Key;  // in the shared table, if there is one
+
+        // the case at CaseIdx, while it is imagined
+        bool Imagined;
+        DangerWindow NewDangerWindow;
+        std::unique_ptr<Field<DangerValue>> NewDangerField;
+        std::optional<ValueView> ValueFieldWithNewDangerField;
+        double ScoreUtility, UseShieldUtility, DeathUtility, CurrentValueUtility, FutureValueUtility,
+            OpponentShieldUtility, OpponentDeathUtility, TerritoryUtility;
+        bool Expands;  // alive with depth left: our next moves are searched
+        int ChildDepth;
+        bool ChildExtended, Quiet;
+        bool ChildReduced;     // the child being searched, which is re-searched if it comes out best
+        bool ChildReSearched;  // the child being searched comes out best reduced, so is searched in full
+        double BestChildUtility;
+        int ChildIdx;
+        double ChildUtilities[AllOperationCount];
+    };
+
+    Game& game;
+    const ValueView& root_value_field;
+    const Field<double>& value_field_without_danger;
+    SearchContext& context;
+
+    int depth = -1;
+    std::vector<Frame> frames;  // never reallocated within an iteration: children point into it
+    int frame_cnt = 0;
+    bool paused = false;
+    int root_idx = 0;  // next root operation
+    bool root_searched[AllOperationCount];
+    double root_utilities[AllOperationCount];
+
+    std::span<const SnakeIdxAndOperation> CaseOperations(const Frame& frame) const {
+        const int snake_cnt = game.SnakeInfos.size();
+        return {context.MoveBuffers[frame.Ply].Cases.data() + frame.CaseIdx * snake_cnt, (size_t)snake_cnt};
+    }
+
+    // Index in AllOperations of the operation tried `order`-th.
+    int OperationIdx(int order) const { return (order + context.MoveOrderShift) % AllOperationCount; }
+
+    // Pushes the node, or delivers its utility right away if another thread has finished it.
+    bool Enter(Operation operation, const ValueView& value_field, int node_depth, int extensions) {
+        uint64_t key = 0;
+        if (context.Table) {
+            key = SearchNodeKey(game, operation, node_depth, MaxSearchExtensions - extensions);
+            if (const std::optional<double> utility = context.Table->Find(key)) {
+                context.TableHits++;
+                Deliver(*utility);
+                return true;
+            }
+        }
+        if (!context.TryVisit()) {
+            return false;
+        }
+        Frame& frame = frames[frame_cnt++];
+        frame.Ply = frame_cnt - 1;
+        frame.Key = key;
+        frame.Op = operation;
+        frame.Depth = node_depth;
+        frame.Extensions = extensions;
+        frame.ValueField = &value_field;
+        frame.CaseIdx = 0;
+        frame.MinUtility = VeryLargeValue;
+        frame.Imagined = false;
+
+        // find all snakes in gambling radius
+        const int my_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
+        const int my_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
+        const int GamblingRadius = 2 * node_depth;
+        MoveBuffer& buffer = context.MoveBuffers[frame.Ply];
+        buffer.GamblingSnakeIdxs.clear();
+        for (SnakeInfo& snake : game.SnakeInfos) {
+            if (!snake.Alive || snake.Idx == game.SelfIdx) {
+                continue;
+            }
+            const int distance = std::abs(snake.Body.front().h - my_h) + std::abs(snake.Body.front().w - my_w);
+            if (distance <= GamblingRadius) {
+                buffer.GamblingSnakeIdxs.push_back(snake.Idx);
+            }
+        }
+
+        // enumerate the sensible operations of gambling snakes, and use default operation for others
+        frame.CaseCnt = GenerateCases(game, operation, buffer);
+        return true;
+    }
+
+    void Deliver(double utility) {
+        if (frame_cnt == 0) {
+            root_searched[OperationIdx(root_idx)] = true;
+            root_utilities[OperationIdx(root_idx++)] = utility;
+        } else {
+            Frame& parent = frames[frame_cnt - 1];
+            if (parent.ChildReduced && utility > parent.BestChildUtility) {
+                parent.ChildReduced = false;
+                parent.ChildReSearched = true;
+                context.ReSearches++;
+                return;
+            }
+            parent.ChildReduced = parent.ChildReSearched = false;
+            parent.ChildUtilities[parent.ChildIdx++] = utility;
+            parent.BestChildUtility = std::max(parent.BestChildUtility, utility);
+        }
+    }
+
+    // Imagines the current case of `frame` and evaluates everything but our next moves.
+    void BeginCase(Frame& frame, bool debug) {
+        const PhaseScope phase(Phase::Evaluate);
+        const std::vector<int>& gambling_snake_idxs = context.MoveBuffers[frame.Ply].GamblingSnakeIdxs;
+        const int score_before = game.SnakeInfos[game.SelfIdx].Score;
+        game.ImagineOperations(CaseOperations(frame), true);
+        frame.Imagined = true;
+        const int new_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
+        const int new_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
+        frame.NewDangerWindow = context.Net && !debug ? context.Net->Window(game) : CreateDangerWindow(game, {new_h, new_w});
+        if (!frame.NewDangerWindow.Certified || debug) {
+            frame.NewDangerField = std::make_unique<Field<DangerValue>>(CreateDangerField(game));
+        }
+        context.DangerWindows++;
+        context.DangerWindowFallbacks += !frame.NewDangerWindow.Certified;
+        if (frame.NewDangerField) {
+            frame.ValueFieldWithNewDangerField.emplace(value_field_without_danger, *frame.NewDangerField);
+        } else {
+            frame.ValueFieldWithNewDangerField.emplace(value_field_without_danger, frame.NewDangerWindow);
+        }
+        int gambling_shield_count_before = 0;
+        for (int snake_idx : gambling_snake_idxs) {
+            if (game.SnakeInfos[snake_idx].ShieldET > 1 && game.SnakeInfos[snake_idx].Name != 2023202303) {
+                gambling_shield_count_before++;
+            }
+        }
+
+        // evaluate
+        SnakeInfo& self = game.SnakeInfos[game.SelfIdx];
+        frame.ScoreUtility = UtilityPerScore * (self.Score - score_before);
+        frame.UseShieldUtility = frame.Op == Shield ? UtilityOfShield : 0;
+        frame.DeathUtility = frame.CurrentValueUtility = frame.FutureValueUtility = 0;
+        frame.OpponentShieldUtility = frame.OpponentDeathUtility = frame.TerritoryUtility = 0;
+        frame.Expands = false;
+        frame.ChildIdx = 0;
+        frame.ChildReduced = frame.ChildReSearched = false;
+        frame.BestChildUtility = VerySmallValue;
+        if (!self.Alive) {
+            // check head to head die
+            bool head_to_head_die = false;
+            for (int snake_idx : gambling_snake_idxs) {
+                if (game.SnakeInfos[snake_idx].Body.front().h == new_h && game.SnakeInfos[snake_idx].Body.front().w == new_w) {
+                    head_to_head_die = true;
+                    break;
+                }
+            }
+            frame.DeathUtility = UtilityPerValue * ValueOfDeathPerRemainTime * game.TimeRemain * (head_to_head_die ? PenaltyDeclineOfHeadToHeadDeath : 1);
+            return;
+        }
+
+        // have not stepped into danger zone
+        frame.CurrentValueUtility = UtilityPerValue * frame.ValueField->Value(new_h, new_w);
+
+        // can step into a safe zone
+        double max_value = VerySmallValue;
+        for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+            if (direction == Reverse(frame.Op)) {
+                continue;
+            }
+            int h_next = new_h + DhOfOperation(direction);
+            int w_next = new_w + DwOfOperation(direction);
+            if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
+                continue;
+            }
+            max_value = std::min(0.0, std::max(max_value, frame.ValueFieldWithNewDangerField->Danger(h_next, w_next)));
+        }
+        frame.FutureValueUtility = DeclinePerDepth * UtilityPerValue * max_value;
+
+        // shield
+        int gambling_shield_count_after = 0;
+        for (int snake_idx : gambling_snake_idxs) {
+            if (game.SnakeInfos[snake_idx].ShieldET > 0 && game.SnakeInfos[snake_idx].Name != 2023202303) {
+                gambling_shield_count_after++;
+            }
+        }
+        frame.OpponentShieldUtility = UtilityOfShield * (gambling_shield_count_after - gambling_shield_count_before);
+
+        // kill
+        for (int idx : gambling_snake_idxs) {
+            if (!game.SnakeInfos[idx].Alive && game.SnakeInfos[idx].Name != 2023202303) {
+                frame.OpponentDeathUtility += UtilityOfOpponentDeath;
+            }
+        }
+
+        // territory
+        if constexpr (EnableTerritoryAtLeaves) {
+            if (frame.Depth == 0) {
+                frame.TerritoryUtility = UtilityPerTerritoryCell * CreateTerritory(game).Area[game.SelfIdx];
+            }
+        }
+
+        // dfs
+        frame.Expands = frame.Depth > 0;
+        frame.ChildDepth = frame.Depth - 1;
+        frame.ChildExtended = frame.Quiet = false;
+        if (EnableSelectiveSearchDepth && frame.Expands) {
+            bool contested = max_value <= SearchExtensionDeathRatio * ValueOfDeathPerRemainTime * game.TimeRemain;
+            for (int snake_idx : gambling_snake_idxs) {
+                const Point head = game.SnakeInfos[snake_idx].Body.front();
+                contested |= game.SnakeInfos[snake_idx].Alive && std::abs(head.h - new_h) + std::abs(head.w - new_w) <= SearchExtensionRadius;
+            }
+            if (contested && frame.Extensions < MaxSearchExtensions) {
+                frame.ChildDepth++;
+                frame.ChildExtended = true;
+                context.Extensions++;
+            }
+            frame.Quiet = !contested && gambling_snake_idxs.empty() && max_value == 0 && frame.ChildDepth >= MinReducedChildDepth + 1;
+        }
+    }
+
+    // Adds our best next move to the case, folds it into the node and revokes the case.
+    void FinishCase(Frame& frame, bool debug) {
+        const double dfs_utility = frame.Expands ? DeclinePerDepth * *std::max_element(frame.ChildUtilities, frame.ChildUtilities + AllOperationCount) : 0;
+        const double utility = frame.ScoreUtility + frame.UseShieldUtility + frame.DeathUtility +
+                               frame.CurrentValueUtility + frame.FutureValueUtility +
+                               frame.OpponentShieldUtility + frame.OpponentDeathUtility + frame.TerritoryUtility + dfs_utility;
+
+        if constexpr (LogEnabled<LogTrace>) {
+            if (debug) {
+                const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+                LogLine<LogTrace> dump;
+                dump.Stream() << "Depth: " << frame.Depth << ", Case: " << frame.CaseIdx << "\n";
+                dump.Stream() << "Operation: " << frame.Op << "\n";
+                dump.Stream() << "Imagined Map:\n";
+                game.PrintMapNearby(dump.Stream(), head, 10);
+                dump.Stream() << "Previous Value Field:\n";
+                frame.ValueField->PrintValuesNearby(dump.Stream(), head, 3);
+                dump.Stream() << "Current Value Field:\n";
+                frame.ValueFieldWithNewDangerField->PrintValuesNearby(dump.Stream(), head, 3);
+                dump.Stream() << "Utility: " << utility << "\n";
+                dump.Stream() << " - Score Utility: " << frame.ScoreUtility << ", Use Shield Utility: " << frame.UseShieldUtility << ", Death Utility: " << frame.DeathUtility << "\n";
+                dump.Stream() << " - Current Value Utility: " << frame.CurrentValueUtility << ", Future Value Utility: " << frame.FutureValueUtility << "\n";
+                dump.Stream() << " - Opponent Shield Utility: " << frame.OpponentShieldUtility << ", Opponent Death Utility: " << frame.OpponentDeathUtility << "\n";
+                dump.Stream() << " - Territory Utility: " << frame.TerritoryUtility << "\n";
+                dump.Stream() << " - DFS Utility: " << dfs_utility << "\n";
+            }
+        }
+
+        frame.MinUtility = std::min(frame.MinUtility, utility);
+        game.RevokeOperations();
+        frame.Imagined = false;
+        frame.ValueFieldWithNewDangerField.reset();
+        frame.NewDangerField.reset();
+        frame.CaseIdx++;
+    }
+
+    void Pause() {
+        for (int i = frame_cnt - 1; i >= 0; i--) {
+            if (frames[i].Imagined) {
+                game.RevokeOperations();
+            }
+        }
+        paused = true;
+    }
+
+    void Resume() {
+        for (int i = 0; i < frame_cnt; i++) {
+            if (frames[i].Imagined) {
+                game.ImagineOperations(CaseOperations(frames[i]), true);
+            }
+        }
+        paused = false;
+    }
+
+   public:
+    MoveSearch(Game& game, const ValueView& root_value_field, const Field<double>& value_field_without_danger, SearchContext& context)
+        : game(game), root_value_field(root_value_field), value_field_without_danger(value_field_without_danger), context(context) {}
+
+    MoveSearch(const MoveSearch&) = delete;
+    void operator=(const MoveSearch&) = delete;
+
+    ~MoveSearch() {
+        // an abandoned iteration must not leave imagined moves behind
+        if (!paused) {
+            Pause();
+        }
+    }
+
+    // Starts the iteration searching `new_depth` more of our moves after the root move,
+    // abandoning the current one if it is paused.
+    void Start(int new_depth) {
+        if (!paused) {
+            Pause();
+        }
+        depth = new_depth;
+        frame_cnt = 0;
+        paused = false;
+        // extensions lengthen the path past the depth
+        const int max_path = depth + 1 + (EnableSelectiveSearchDepth ? MaxSearchExtensions : 0);
+        if ((int)frames.size() < max_path) {
+            frames.resize(max_path);
+        }
+        if ((int)context.MoveBuffers.size() < max_path) {
+            context.MoveBuffers.resize(max_path);
+        }
+        root_idx = 0;
+        std::fill(root_searched, root_searched + AllOperationCount, false);
+        std::fill(root_utilities, root_utilities + AllOperationCount, VerySmallValue);
+    }
+
+    bool Finished() const { return root_idx == AllOperationCount; }
+
+    // Works on the iteration until it is finished (true) or the budget is used up (false).
+    bool Run() {
+        const PhaseScope phase(Phase::Search);
+        if (paused) {
+            Resume();
+        }
+        while (true) {
+            if (frame_cnt == 0) {
+                if (Finished()) {
+                    return true;
+                }
+                const Operation operation = AllOperations[OperationIdx(root_idx)];
+                if (!game.CanOperate(game.SelfIdx, operation)) {
+                    root_idx++;
+                } else if (!Enter(operation, root_value_field, depth, 0)) {
+                    Pause();
+                    return false;
+                }
+                continue;
+            }
+
+            Frame& frame = frames[frame_cnt - 1];
+            // trace builds dump every case of the first level, which needs the full danger field
+            const bool debug = LogEnabled<LogTrace> && frame_cnt == 1;
+            if (!frame.Imagined) {
+                if (frame.CaseIdx == frame.CaseCnt) {
+                    if (context.Table) {
+                        context.Table->Store(frame.Key, frame.MinUtility);
+                    }
+                    frame_cnt--;
+                    Deliver(frame.MinUtility);
+                } else {
+                    BeginCase(frame, debug);
+                }
+            } else if (frame.Expands && frame.ChildIdx < AllOperationCount) {
+                const Operation operation = AllOperations[OperationIdx(frame.ChildIdx)];
+                if (!game.CanOperate(game.SelfIdx, operation)) {
+                    frame.ChildUtilities[frame.ChildIdx++] = UtilityPerValue * ValueOfDeathPerRemainTime * game.TimeRemain;
+                    continue;
+                }
+                // a quiet case searches its first child in full, the rest reduced until one comes out best
+                const bool reduce = frame.Quiet && frame.BestChildUtility > VerySmallValue && !frame.ChildReSearched;
+                const int child_depth = reduce ? frame.ChildDepth - 1 : frame.ChildDepth;
+                frame.ChildReduced = reduce;
+                if (!Enter(operation, *frame.ValueFieldWithNewDangerField, child_depth, frame.Extensions + frame.ChildExtended)) {
+                    Pause();
+                    return false;
+                }
+                context.Reductions += reduce;
+            } else {
+                FinishCase(frame, debug);
+            }
+        }
+    }
+
+    // Utility of each root operation searched so far in this iteration, VerySmallValue otherwise.
+    const double* RootUtilities() const { return root_utilities; }
+    bool RootSearched(int idx) const { return root_searched[idx]; }
+
+    // Best root operations among those searched so far, all of them on ties.
+    std::vector<Operation> BestSoFar() const {
+        std::vector<Operation> best_operations;
+        double best_utility = VerySmallValue;
+        for (int i = 0; i < AllOperationCount; i++) {
+            if (!root_searched[i]) {
+                continue;
+            }
+            if (root_utilities[i] > best_utility) {
+                best_utility = root_utilities[i];
+                best_operations.clear();
+                best_operations.push_back(AllOperations[i]);
+            } else if (root_utilities[i] == best_utility) {
+                best_operations.push_back(AllOperations[i]);
+            }
+        }
+        return best_operations;
+    }
+};
+
+//
+//  Endgame Solver
+//
+
+constexpr int EndgameTickThreshold = 8;      // solve exactly once at most this many ticks remain
+constexpr double EndgameBudgetRatio = 0.5;   // share of the tick the solver may use before falling back
+constexpr int EndgameNodesPerClockCheck = 256;
+constexpr long long EndgameNodeLimitWithoutDeadline = 10000;  // about the share of a tick the solver gets
+
+struct EndgameResult {
+    bool Proven;
+    int FinalScores[AllOperationCount];  // our final score after each root move, INT_MIN if illegal
+    long long Nodes;
+};
+
+// Searches the remaining game on our final score with alpha-beta and a memo of proven bounds.
+// Opponents follow the same model as UtilityOfMyMove: snakes that can still reach us (or a
+// bean we could reach) are adversarial, the others keep their last operation. A proven score
+// is exact only under that model.
+class EndgameSolver {
+   private:
+    struct Bound {
+        int Lower, Upper;
+    };
+
+    Game& game;
+    std::chrono::system_clock::time_point should_finish_before;
+    long long max_nodes;
+    std::unordered_map<uint64_t, Bound> memo;
+    long long nodes = 0;
+    bool out_of_budget = false;  // once set, every call returns at once and nothing is memoized
+    std::vector<std::pair<Point, int>> beans;  // scratch of UpperBound
+    std::vector<int> bean_values;              // scratch of BestBeans
+
+    // Counts the node, or notes that the nodes or the time ran out.
+    bool TryVisit() {
+        if (nodes >= max_nodes ||
+            ((nodes + 1) % EndgameNodesPerClockCheck == 0 && std::chrono::high_resolution_clock::now() > should_finish_before)) {
+            out_of_budget = true;
+            return false;
+        }
+        nodes++;
+        return true;
+    }
+
+    // Sum of the `eat_cnt` largest bean values `reachable` accepts.
+    template <typename Reachable>
+    int BestBeans(int eat_cnt, Reachable reachable) {
+        bean_values.clear();
+        for (const auto& [point, value] : beans) {
+            if (reachable(point)) {
+                bean_values.push_back(value);
+            }
+        }
+        eat_cnt = std::min<int>(eat_cnt, bean_values.size());
+        std::partial_sort(bean_values.begin(), bean_values.begin() + eat_cnt, bean_values.end(), std::greater<int>());
+        return std::accumulate(bean_values.begin(), bean_values.begin() + eat_cnt, 0);
+    }
+
+    // Our score plus what we could still eat: at most one cell a tick, either a bean we can reach
+    // or a box some opponent drops. A death drops at most the snake's score, one box of up to 20
+    // per body cell from the head, and the snake may eat beans within its own reach first. The
+    // boxes then lie on cells its head reaches from now on or on its current first boxes' worth
+    // of body cells, so a snake adds its possible drop if either could be within our reach.
+    int UpperBound() {
+        const SnakeInfo& self = game.SnakeInfos[game.SelfIdx];
+        const Point head = self.Body.front();
+        const int remain = game.TimeRemain;
+        beans.clear();
+        for (int h = 0; h < Height; h++) {
+            for (int w = 0; w < Width; w++) {
+                const ObjType obj = game.Map[h][w].Obj;
+                if (obj > ScoreZero && obj < ScoreTooLarge) {
+                    beans.push_back({{.h = h, .w = w}, obj - ScoreZero});
+                }
+            }
+        }
+        int bound = self.Score + BestBeans(remain, [&](Point point) {
+                        const int distance = TerrainDistances.Distance(head, point);
+                        return distance != -1 && distance <= remain;
+                    });
+        for (const SnakeInfo& snake : game.SnakeInfos) {
+            if (!snake.Alive || snake.Idx == game.SelfIdx) {
+                continue;
+            }
+            const Point snake_head = snake.Body.front();
+            const int drop = snake.Score + BestBeans(remain, [&](Point point) {
+                                 return std::abs(point.h - snake_head.h) + std::abs(point.w - snake_head.w) <= remain;
+                             });
+            if (drop <= 0) {
+                continue;
+            }
+            bool near = std::abs(snake_head.h - head.h) + std::abs(snake_head.w - head.w) <= 2 * remain;
+            int box_cnt = (drop + 19) / 20;
+            for (auto it = snake.Body.begin(); it != snake.Body.end() && box_cnt > 0 && !near; ++it, box_cnt--) {
+                near = std::abs(it->h - head.h) + std::abs(it->w - head.w) <= remain;
+            }
+            if (near) {
+                bound += drop;
+            }
+        }
+        return bound;
+    }
+
+    int Solve(int alpha, int beta) {
+        const SnakeInfo& self = game.SnakeInfos[game.SelfIdx];
+        if (game.TimeRemain <= 0 || !self.Alive) {
+            return self.Score;
+        }
+        if (!TryVisit()) {
+            return alpha;
+        }
+
+        const uint64_t hash = game.PositionHash();
+        auto memo_it = memo.find(hash);
+        if (memo_it != memo.end()) {
+            if (memo_it->second.Lower >= beta) {
+                return memo_it->second.Lower;
+            }
+            if (memo_it->second.Upper <= alpha) {
+                return memo_it->second.Upper;
+            }
+            alpha = std::max(alpha, memo_it->second.Lower);
+            beta = std::min(beta, memo_it->second.Upper);
+            if (alpha >= beta) {
+                return alpha;
+            }
+        }
+        const int upper_bound = UpperBound();
+        if (upper_bound <= alpha) {
+            return upper_bound;
+        }
+
+        const int alpha_before = alpha;
+        int best = INT_MIN;
+        for (Operation operation : AllOperations) {
+            if (!game.CanOperate(game.SelfIdx, operation)) {
+                continue;
+            }
+            const int value = SolveMove(operation, std::max(alpha, best), beta);
+            if (out_of_budget) {
+                return alpha;
+            }
+            best = std::max(best, value);
+            if (best >= beta) {
+                break;
+            }
+        }
+        if (best == INT_MIN) {
+            // no legal move: we die now and keep the current score
+            best = self.Score;
+        }
+
+        Bound bound = memo_it != memo.end() ? memo_it->second : Bound{.Lower = INT_MIN, .Upper = INT_MAX};
+        if (best <= alpha_before) {
+            bound.Upper = std::min(bound.Upper, best);
+        } else if (best >= beta) {
+            bound.Lower = std::max(bound.Lower, best);
+        } else {
+            bound = Bound{.Lower = best, .Upper = best};
+        }
+        memo[hash] = bound;
+        return best;
+    }
+
+    // Worst case over the opponents' replies to our `operation`.
+    int SolveMove(Operation operation, int alpha, int beta) {
+        const int snake_cnt = game.SnakeInfos.size();
+        const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+        std::vector<int> gambling_snake_idxs;
+        for (const SnakeInfo& snake : game.SnakeInfos) {
+            if (!snake.Alive || snake.Idx == game.SelfIdx) {
+                continue;
+            }
+            const int distance = std::abs(snake.Body.front().h - head.h) + std::abs(snake.Body.front().w - head.w);
+            if (distance <= 2 * game.TimeRemain) {
+                gambling_snake_idxs.push_back(snake.Idx);
+            }
+        }
+
+        std::vector<SnakeIdxAndOperation> operations(snake_cnt);
+        for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
+            operations[snake_idx] = {
+                .Idx = snake_idx,
+                .Op = snake_idx == game.SelfIdx ? operation : game.SnakeInfos[snake_idx].LastOperation,
+            };
+        }
+        int worst = INT_MAX;
+        std::vector<int> enumerate_stack(gambling_snake_idxs.size(), 0);
+        while (true) {
+            bool is_valid = true;
+            for (int i = 0; i < (int)gambling_snake_idxs.size(); i++) {
+                const Operation op = AllOperations[enumerate_stack[i]];
+                if (game.SnakeInfos[gambling_snake_idxs[i]].LastOperation == Reverse(op)) {
+                    is_valid = false;
+                    break;
+                }
+                operations[gambling_snake_idxs[i]].Op = op;
+            }
+            if (is_valid) {
+                game.ImagineOperations(operations, true);
+                const int value = Solve(alpha, std::min(beta, worst));
+                game.RevokeOperations();
+                if (out_of_budget) {
+                    return worst;
+                }
+                worst = std::min(worst, value);
+                if (worst <= alpha) {
+                    break;
+                }
+            }
+
+            int i = (int)gambling_snake_idxs.size() - 1;
+            while (i >= 0 && enumerate_stack[i] == AllOperationCount - 1) {
+                enumerate_stack[i] = 0;
+                i--;
+            }
+            if (i < 0) {
+                break;
+            }
+            enumerate_stack[i]++;
+        }
+        return worst;
+    }
+
+   public:
+    EndgameSolver(Game& game, std::chrono::system_clock::time_point should_finish_before, long long max_nodes = LLONG_MAX)
+        : game(game), should_finish_before(should_finish_before), max_nodes(max_nodes) {}
+
+    EndgameResult SolveRoot() {
+        EndgameResult result;
+        result.Proven = true;
+        std::fill(result.FinalScores, result.FinalScores + AllOperationCount, INT_MIN);
+        TerrainDistances.Sync(game);
+        for (int i = 0; i < AllOperationCount && !out_of_budget; i++) {
+            if (game.CanOperate(game.SelfIdx, AllOperations[i])) {
+                // full window per root move: ties between moves must be exact too
+                result.FinalScores[i] = SolveMove(AllOperations[i], INT_MIN, INT_MAX);
+            }
+        }
+        result.Proven = !out_of_budget;
+        result.Nodes = nodes;
+        Log<LogInfo>() << "Endgame: " << (result.Proven ? "proven while far snakes keep their last operation" : "unfinished") << ", "
+                       << nodes << " nodes, " << memo.size() << " memo entries";
+        return result;
+    }
+};
+
+//
+//  Decision
+//
+
+struct Decision {
+    Operation Op;
+    int Depth;                            // deepest completed search depth, -1 if none
+    double Utilities[AllOperationCount];  // root utilities at `Depth`, VerySmallValue if not searched
+    long long Nodes;
+    long long ElapsedMicroseconds;
+    long long SetupMicroseconds;  // spent before the move search started
+};
+
+// Without a deadline (`should_finish_before` at time_point::max()) the search is bounded only by
+// `max_depth` and `max_nodes`, and gives the same decision for the same position on any machine.
+Decision Decide(Game& game,
+                std::chrono::system_clock::time_point start_time,
+                std::chrono::system_clock::time_point should_finish_before,
+                int max_depth = INT_MAX,
+                long long max_nodes = LLONG_MAX,
+                int search_threads = 1) {
+    const bool deterministic = should_finish_before == std::chrono::system_clock::time_point::max();
+    SearchContext context{.ShouldFinishBefore = should_finish_before, .MaxNodes = max_nodes};
+    Decision decision;
+    decision.Depth = -1;
+    std::fill(decision.Utilities, decision.Utilities + AllOperationCount, VerySmallValue);
+    const long long pattern_lookups_before = DangerPatterns.Lookups;
+    const long long pattern_hits_before = DangerPatterns.Hits;
+
+    ValueFields fields = CreateValueFields(game, RootFieldThreads);
+    const Field<DangerValue>& DangerField = fields.DangerField;
+    const Field<double>& ValueFieldWithoutDangerField = fields.ValueFieldWithoutDangerField;
+    Field<double> ValueField = CapValueByDanger(ValueFieldWithoutDangerField, DangerField);
+    const ValueView RootValueView(ValueFieldWithoutDangerField, DangerField);
+    std::vector<std::vector<Operation>> best_operations_by_depth;
+    int depth = 0;
+
+    // endgame: try to prove the best final score (with far snakes keeping their last operation),
+    // fall back to the heuristic search if it runs out of time
+    bool endgame_proven = false;
+    long long endgame_nodes = 0;
+    if (game.TimeRemain <= EndgameTickThreshold) {
+        auto endgame_finish_before = std::chrono::system_clock::time_point::max();
+        long long endgame_max_nodes = max_nodes == LLONG_MAX ? LLONG_MAX : (long long)(max_nodes * EndgameBudgetRatio);
+        if (!deterministic) {
+            const auto endgame_budget = std::min<std::chrono::system_clock::duration>(should_finish_before - start_time, std::chrono::milliseconds(ExecutionMillisecondLimit));
+            endgame_finish_before = start_time + std::chrono::duration_cast<std::chrono::system_clock::duration>(endgame_budget * EndgameBudgetRatio);
+        } else if (max_nodes == LLONG_MAX) {
+            endgame_max_nodes = EndgameNodeLimitWithoutDeadline;
+        }
+        EndgameResult endgame = EndgameSolver(game, endgame_finish_before, endgame_max_nodes).SolveRoot();
+        endgame_nodes = endgame.Nodes;
+        if (max_nodes != LLONG_MAX) {
+            context.MaxNodes = std::max(0LL, max_nodes - endgame_nodes);
+        }
+        if (endgame.Proven) {
+            endgame_proven = true;
+            best_operations_by_depth.push_back(std::vector<Operation>());
+            const int best_final_score = *std::max_element(endgame.FinalScores, endgame.FinalScores + AllOperationCount);
+            for (int i = 0; i < AllOperationCount; i++) {
+                if (endgame.FinalScores[i] != INT_MIN) {
+                    decision.Utilities[i] = endgame.FinalScores[i];
+                    if (endgame.FinalScores[i] == best_final_score) {
+                        best_operations_by_depth[0].push_back(AllOperations[i]);
+                    }
+                }
+                Log<LogDebug>() << "Endgame Operation: " << AllOperations[i] << ", Final Score: " << endgame.FinalScores[i];
+            }
+            depth = game.TimeRemain - 1;
+        }
+    }
+
+    decision.SetupMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+    // lazy SMP: helpers run the same iterative deepening on copies of the game, starting deeper
+    // and trying our operations in another order, and share finished nodes through the table
+    struct HelperResult {
+        int Depth = -1;
+        std::vector<Operation> BestOperations;
+        double Utilities[AllOperationCount];
+        long long Nodes = 0, TableHits = 0;
+    };
+    std::unique_ptr<SharedUtilityTable> table;
+    std::atomic<bool> stop_helpers{false};
+    std::vector<HelperResult> helper_results(std::max(0, search_threads - 1));
+    std::vector<std::thread> helpers;
+    if (search_threads > 1 && !endgame_proven) {
+        table = std::make_unique<SharedUtilityTable>();
+        context.Table = table.get();
+        if (context.MaxNodes != LLONG_MAX) {
+            // the node budget is for all threads together
+            context.MaxNodes /= search_threads;
+        }
+        for (int t = 1; t < search_threads; t++) {
+            helpers.emplace_back([&, t, helper_game = game, start_depth = depth]() mutable {
+                SearchContext helper_context{
+                    .ShouldFinishBefore = should_finish_before,
+                    .MaxNodes = context.MaxNodes,
+                    .Table = table.get(),
+                    .Stop = &stop_helpers,
+                    .MoveOrderShift = t,
+                };
+                HelperResult& result = helper_results[t - 1];
+                MoveSearch helper_search(helper_game, RootValueView, ValueFieldWithoutDangerField, helper_context);
+                for (int helper_depth = start_depth + (t + 1) / 2; helper_depth <= helper_game.TimeRemain && helper_depth <= max_depth; helper_depth++) {
+                    helper_search.Start(helper_depth);
+                    if (!helper_search.Run()) {
+                        break;
+                    }
+                    result.Depth = helper_depth;
+                    result.BestOperations = helper_search.BestSoFar();
+                    std::copy(helper_search.RootUtilities(), helper_search.RootUtilities() + AllOperationCount, result.Utilities);
+                }
+                result.Nodes = helper_context.Nodes;
+                result.TableHits = helper_context.TableHits;
+                MergeThreadInstrumentation();
+            });
+        }
+    }
+
+    MoveSearch search(game, RootValueView, ValueFieldWithoutDangerField, context);
+    while (!endgame_proven && depth <= game.TimeRemain && depth <= max_depth) {
+        search.Start(depth);
+        if (!search.Run()) {
+            // the game is back at the root position; keep the last finished depth
+            std::vector<Operation> partial = search.BestSoFar();
+            LogLine<LogInfo> line;
+            line << "Depth " << depth << " paused";
+            if (!partial.empty()) {
+                line << ", best so far: " << partial.front();
+            }
+            break;
+        }
+        for (int i = 0; i < AllOperationCount; i++) {
+            if (search.RootSearched(i)) {
+                Log<LogDebug>() << "Depth: " << depth << ", Operation: " << AllOperations[i] << ", Utility: " << search.RootUtilities()[i];
+            }
+        }
+        best_operations_by_depth.push_back(search.BestSoFar());
+        std::copy(search.RootUtilities(), search.RootUtilities() + AllOperationCount, decision.Utilities);
+        Log<LogInfo>() << "Depth " << depth << " finished, current time: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count() << "ms";
+        depth++;
+    }
+    if (!endgame_proven) {
+        depth--;
+    }
+    decision.Depth = best_operations_by_depth.empty() ? -1 : depth;
+
+    // the deepest finished iteration of any thread decides
+    stop_helpers.store(true, std::memory_order_relaxed);
+    long long helper_nodes = 0, table_hits = context.TableHits;
+    for (size_t i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+        const HelperResult& result = helper_results[i];
+        helper_nodes += result.Nodes;
+        table_hits += result.TableHits;
+        if (result.Depth > decision.Depth) {
+            Log<LogInfo>() << "Depth " << result.Depth << " finished by helper " << i + 1;
+            decision.Depth = result.Depth;
+            best_operations_by_depth.push_back(result.BestOperations);
+            std::copy(result.Utilities, result.Utilities + AllOperationCount, decision.Utilities);
+        }
+    }
+
+    std::vector<Operation> best_operations = best_operations_by_depth.size() > 0 ? best_operations_by_depth.back() : std::vector<Operation>();
+    Operation best_operation = Shield;
+    if (best_operations.empty()) {
+        Log<LogInfo>() << "No operation available";
+        best_operation = Shield;
+    } else if (best_operations.size() == 1) {
+        best_operation = best_operations[0];
+    } else {
+        double best_value = VerySmallValue;
+        for (Operation operation : best_operations) {
+            if (!game.CanOperate(game.SelfIdx, operation)) {
+                continue;
+            }
+            int dh, dw;
+            dh = DhOfOperation(operation);
+            dw = DwOfOperation(operation);
+            int head_h, head_w, head_h_next, head_w_next;
+            head_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
+            head_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
+            head_h_next = head_h + dh;
+            head_w_next = head_w + dw;
+            double value = ValueField[head_h_next][head_w_next];
+            if (value >= best_value) {
+                best_value = value;
+                best_operation = operation;
+            }
+        }
+    }
+
+    decision.Op = best_operation;
+    decision.Nodes = endgame_nodes + context.Nodes + helper_nodes;
+    decision.ElapsedMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    Log<LogInfo>() << "Danger windows: " << context.DangerWindows << ", fallbacks to full field: " << context.DangerWindowFallbacks;
+    if constexpr (EnableSelectiveSearchDepth) {
+        Log<LogInfo>() << "Extended cases: " << context.Extensions << ", reduced children: " << context.Reductions << ", re-searched: " << context.ReSearches;
+    }
+    const long long pattern_lookups = DangerPatterns.Lookups - pattern_lookups_before;
+    const long long pattern_hits = DangerPatterns.Hits - pattern_hits_before;
+    Log<LogInfo>() << "Danger pattern cache: " << pattern_hits << " hits of " << pattern_lookups << " lookups ("
+                   << (pattern_lookups > 0 ? 100.0 * pattern_hits / pattern_lookups : 0.0) << "%)";
+    if (!helpers.empty()) {
+        Log<LogInfo>() << "Search threads: " << helpers.size() + 1 << ", helper nodes: " << helper_nodes << ", shared table hits: " << table_hits;
+    }
+    Log<LogInfo>() << "Nodes: " << decision.Nodes << " in " << decision.ElapsedMicroseconds << "us, "
+                   << (decision.ElapsedMicroseconds > 0 ? decision.Nodes * 1e6 / decision.ElapsedMicroseconds : 0.0) << " nodes/s, "
+                   << (decision.Nodes > 0 ? (double)decision.ElapsedMicroseconds / decision.Nodes : 0.0) << "us/node";
+    return decision;
+}
+
+//
+//  Trace Recording and Replay
+//
+
+// A trace is a plain concatenation of records, one per tick: a fixed header followed by the
+// GameSnapshot with its unused BodyCells tail trimmed (~3 KB per tick).
+constexpr uint32_t TraceMagic = 0x52544E53;  // "SNTR"
+constexpr uint16_t TraceVersion = 1;
+
+struct TraceRecordHeader {
+    uint32_t Magic;
+    uint16_t Version;
+    int8_t Op;
+    int8_t Reserved;
+    int32_t Depth;
+    uint32_t SnapshotBytes;
+    double Utilities[AllOperationCount];
+    int64_t Nodes;
+    int64_t ElapsedMicroseconds;
+};
+
+bool AppendTraceRecord(const char* path, const GameSnapshot& snapshot, const Decision& decision) {
+    FILE* file = fopen(path, "ab");
+    if (!file) {
+        return false;
+    }
+    TraceRecordHeader header{
+        .Magic = TraceMagic,
+        .Version = TraceVersion,
+        .Op = (int8_t)decision.Op,
+        .Reserved = 0,
+        .Depth = decision.Depth,
+        .SnapshotBytes = (uint32_t)(offsetof(GameSnapshot, BodyCells) + snapshot.BodyCellCnt * sizeof(uint16_t)),
+        .Nodes = decision.Nodes,
+        .ElapsedMicroseconds = decision.ElapsedMicroseconds,
+    };
+    std::copy(decision.Utilities, decision.Utilities + AllOperationCount, header.Utilities);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(&snapshot, header.SnapshotBytes, 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+bool ReadTraceRecord(FILE* file, TraceRecordHeader& header, GameSnapshot& snapshot) {
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        return false;
+    }
+    if (header.Magic != TraceMagic || header.Version != TraceVersion || header.SnapshotBytes > sizeof(GameSnapshot)) {
+        Log<LogError>() << "Corrupted trace record";
+        return false;
+    }
+    return fread(&snapshot, header.SnapshotBytes, 1, file) == 1;
+}
+
+// Re-decides every recorded tick with the current build and reports where it disagrees.
+// With `max_depth` or `max_nodes` set the replay is time-independent and runs as fast as the search allows.
+int ReplayTrace(const char* path, int max_depth, long long max_nodes, int millisecond_limit) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        Log<LogError>() << "Cannot open trace " << path;
+        return 1;
+    }
+    int record_cnt = 0, diff_cnt = 0;
+    long long recorded_micros = 0, replay_micros = 0, recorded_nodes = 0, replay_nodes = 0;
+    long long recorded_depths = 0, replay_depths = 0;
+    TraceRecordHeader header;
+    static GameSnapshot snapshot;
+    while (ReadTraceRecord(file, header, snapshot)) {
+        Game game(snapshot);
+        auto start_time = std::chrono::high_resolution_clock::now();
+        auto should_finish_before = max_depth == INT_MAX && max_nodes == LLONG_MAX ? start_time + std::chrono::milliseconds(millisecond_limit)
+                                                                                  : std::chrono::system_clock::time_point::max();
+        Decision decision = Decide(game, start_time, should_finish_before, max_depth, max_nodes);
+        DrainLog();
+        if (decision.Op != header.Op) {
+            diff_cnt++;
+            std::cout << "Record " << record_cnt << " (time remain " << snapshot.TimeRemain << "): recorded " << (int)header.Op
+                      << " at depth " << header.Depth << ", replayed " << decision.Op << " at depth " << decision.Depth << std::endl;
+        }
+        record_cnt++;
+        recorded_micros += header.ElapsedMicroseconds;
+        replay_micros += decision.ElapsedMicroseconds;
+        recorded_nodes += header.Nodes;
+        replay_nodes += decision.Nodes;
+        recorded_depths += header.Depth;
+        replay_depths += decision.Depth;
+    }
+    fclose(file);
+    if (record_cnt == 0) {
+        std::cout << "No records" << std::endl;
+        return 1;
+    }
+    auto per_second = [](long long count, long long micros) { return micros > 0 ? count * 1e6 / micros : 0.0; };
+    auto per_node = [](long long count, long long micros) { return count > 0 ? (double)micros / count : 0.0; };
+    std::cout << "Records: " << record_cnt << ", decision diffs: " << diff_cnt << std::endl;
+    std::cout << "Recorded: " << recorded_micros / 1000 << "ms, avg depth " << (double)recorded_depths / record_cnt << ", " << recorded_nodes << " nodes, "
+              << per_second(recorded_nodes, recorded_micros) << " nodes/s, " << per_node(recorded_nodes, recorded_micros) << "us/node" << std::endl;
+    std::cout << "Replayed: " << replay_micros / 1000 << "ms, avg depth " << (double)replay_depths / record_cnt << ", " << replay_nodes << " nodes, "
+              << per_second(replay_nodes, replay_micros) << " nodes/s, " << per_node(replay_nodes, replay_micros) << "us/node" << std::endl;
+    return 0;
+}
+
+//
+//  Batch Decisions
+//
+
+// Runs task(i) for every i in [0, task_cnt) on `thread_cnt` threads. Each thread works through
+// its own contiguous share and, once that runs dry, steals from the far end of the others'.
+void ParallelFor(int task_cnt, int thread_cnt, const std::function<void(int)>& task) {
+    struct Share {
+        std::mutex Mutex;
+        int Begin, End;
+    };
+    thread_cnt = std::max(1, std::min(thread_cnt, task_cnt));
+    std::vector<Share> shares(thread_cnt);
+    for (int t = 0; t < thread_cnt; t++) {
+        shares[t].Begin = (long long)task_cnt * t / thread_cnt;
+        shares[t].End = (long long)task_cnt * (t + 1) / thread_cnt;
+    }
+    auto worker = [&](int t) {
+        while (true) {
+            int idx = -1;
+            for (int k = 0; k < thread_cnt && idx < 0; k++) {
+                Share& share = shares[(t + k) % thread_cnt];
+                std::lock_guard<std::mutex> lock(share.Mutex);
+                if (share.Begin < share.End) {
+                    idx = k == 0 ? share.Begin++ : --share.End;
+                }
+            }
+            if (idx < 0) {
+                return;
+            }
+            task(idx);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_cnt; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// A position for DecideBatch, given as `Input` in the format the bot reads from stdin, or as
+// `Snapshot` if that is not null. Without any limit the search gets the usual time limit.
+struct BatchPosition {
+    std::string Input;
+    const GameSnapshot* Snapshot = nullptr;
+    int MaxDepth = INT_MAX;
+    long long MaxNodes = LLONG_MAX;
+    int MillisecondLimit = 0;  // 0: bounded by MaxDepth and MaxNodes only, and deterministic
+};
+
+// Decides every position on a pool of `thread_cnt` threads (all cores if 0). A position we are
+// not part of gets Depth -1 and no nodes.
+std::vector<Decision> DecideBatch(const std::vector<BatchPosition>& positions, int thread_cnt = 0) {
+    if (thread_cnt <= 0) {
+        thread_cnt = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<Decision> decisions(positions.size());
+    ParallelFor(positions.size(), thread_cnt, [&](int idx) {
+        const BatchPosition& position = positions[idx];
+        std::istringstream input(position.Input);
+        Game game = position.Snapshot ? Game(*position.Snapshot) : Game(input);
+        Decision& decision = decisions[idx];
+        if (game.SelfIdx == EmptyIdx) {
+            decision = Decision{.Op = Shield, .Depth = -1, .Nodes = 0, .ElapsedMicroseconds = 0};
+            std::fill(decision.Utilities, decision.Utilities + AllOperationCount, VerySmallValue);
+            return;
+        }
+        const int millisecond_limit = position.MillisecondLimit == 0 && position.MaxDepth == INT_MAX && position.MaxNodes == LLONG_MAX
+                                          ? ExecutionMillisecondLimit
+                                          : position.MillisecondLimit;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        auto should_finish_before = millisecond_limit > 0 ? start_time + std::chrono::milliseconds(millisecond_limit)
+                                                          : std::chrono::system_clock::time_point::max();
+        decision = Decide(game, start_time, should_finish_before, position.MaxDepth, position.MaxNodes);
+        DrainLog();
+    });
+    return decisions;
+}
+
+// Decides every position in a file of positions in the stdin format, one after another, and
+// prints one line per position: index, operation, depth, nodes and microseconds.
+int RunBatch(const char* path, int thread_cnt, int max_depth, long long max_nodes, int millisecond_limit) {
+    constexpr int PositionsPerChunk = 4096;  // bounds memory on large files
+    std::ifstream file(path);
+    if (!file) {
+        Log<LogError>() << "Cannot open batch " << path;
+        return 1;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    const std::string content = text.str();
+    std::istringstream input(content);
+
+    int position_cnt = 0;
+    long long total_nodes = 0, total_micros = 0;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    while (true) {
+        std::vector<BatchPosition> positions;
+        while ((int)positions.size() < PositionsPerChunk && !(input >> std::ws).eof()) {
+            // parse once to find where the position ends
+            const std::streampos begin = input.tellg();
+            Game game(input);
+            if (input.fail()) {
+                Log<LogError>() << "Malformed position " << position_cnt + positions.size();
+                return 1;
+            }
+            const std::streampos end = input.eof() ? std::streampos(content.size()) : input.tellg();
+            positions.push_back(BatchPosition{
+                .Input = content.substr(begin, end - begin),
+                .MaxDepth = max_depth,
+                .MaxNodes = max_nodes,
+                .MillisecondLimit = millisecond_limit,
+            });
+        }
+        if (positions.empty()) {
+            break;
+        }
+        std::vector<Decision> decisions = DecideBatch(positions, thread_cnt);
+        for (const Decision& decision : decisions) {
+            std::cout << position_cnt++ << " " << decision.Op << " " << decision.Depth << " " << decision.Nodes << " " << decision.ElapsedMicroseconds << "\n";
+            total_nodes += decision.Nodes;
+            total_micros += decision.ElapsedMicroseconds;
+        }
+    }
+    const long long wall_micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    std::cout << "Positions: " << position_cnt << ", " << wall_micros / 1000 << "ms wall, " << total_micros / 1000 << "ms searching, "
+              << (wall_micros > 0 ? total_nodes * 1e6 / wall_micros : 0.0) << " nodes/s" << std::endl;
+    return 0;
+}
+
+//
+//  Stress Positions
+//
+
+// Crowded boards for measuring how the bot scales with the number of snakes. Positions are
+// random but reproducible from their seed, and come in the format the bot reads from stdin.
+constexpr int StressSnakeCounts[] = {10, 20, 30, 40, 50};
+constexpr int StressObjectCount = 120;
+constexpr int StressMaxSnakeLength = 12;
+
+std::string GenerateStressPosition(int snake_cnt, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    auto uniform = [&](int low, int high) { return std::uniform_int_distribution<int>(low, high)(rng); };
+    bool taken[Height][Width] = {};
+    std::ostringstream output;
+    // clear of the endgame solver, so every tick runs the plain search
+    output << uniform(EndgameTickThreshold + 1, TotalTime - 1) << "\n";
+
+    output << StressObjectCount << "\n";
+    for (int i = 0; i < StressObjectCount; i++) {
+        const int h = uniform(0, Height - 1), w = uniform(0, Width - 1);
+        const int roll = uniform(0, 9);
+        const int type_idx = roll == 0 ? -4 : roll == 1 ? -2 : roll == 2 ? -1 : uniform(1, 10);
+        taken[h][w] = true;
+        output << h << " " << w << " " << type_idx << "\n";
+    }
+
+    output << snake_cnt << "\n";
+    for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
+        // a self-avoiding random walk from the tail; crowded boards may need a few tries
+        std::vector<Point> body;
+        const int length = uniform(3, StressMaxSnakeLength);
+        for (int attempt = 0; attempt < 1000 && (int)body.size() < length; attempt++) {
+            body.assign(1, Point{.h = uniform(0, Height - 1), .w = uniform(0, Width - 1)});
+            if (taken[body[0].h][body[0].w]) {
+                body.clear();
+                continue;
+            }
+            while ((int)body.size() < length) {
+                Point free_cells[4];
+                int free_cnt = 0;
+                for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+                    const Point next{.h = body.back().h + DhOfOperation(direction), .w = body.back().w + DwOfOperation(direction)};
+                    if (next.h >= 0 && next.h < Height && next.w >= 0 && next.w < Width && !taken[next.h][next.w] &&
+                        std::find_if(body.begin(), body.end(), [&](const Point& p) { return p.h == next.h && p.w == next.w; }) == body.end()) {
+                        free_cells[free_cnt++] = next;
+                    }
+                }
+                if (free_cnt == 0) {
+                    break;
+                }
+                body.push_back(free_cells[uniform(0, free_cnt - 1)]);
+            }
+        }
+        std::reverse(body.begin(), body.end());  // head first
+        Operation last_operation = Operation::Left;
+        for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
+            if (body.size() > 1 && body[1].h + DhOfOperation(direction) == body[0].h && body[1].w + DwOfOperation(direction) == body[0].w) {
+                last_operation = direction;
+            }
+        }
+        const int shield_cd = uniform(0, 3) == 0 ? uniform(1, ShieldCD) : 0;
+        const int shield_et = shield_cd > ShieldCD - ShieldET ? shield_cd - (ShieldCD - ShieldET) : 0;
+        output << (snake_idx == 0 ? SelfName : snake_idx) << " " << body.size() << " " << uniform(0, 60) << " " << last_operation << " "
+               << shield_cd << " " << shield_et << "\n";
+        for (const Point& point : body) {
+            taken[point.h][point.w] = true;
+            output << point.h << " " << point.w << "\n";
+        }
+    }
+    return output.str();
+}
+
+// Plays `position_cnt` crowded positions for every snake count, one at a time as the judge
+// would, and reports percentiles of the time before the search starts and of the whole tick.
+int RunStress(int position_cnt, int max_depth, long long max_nodes, int millisecond_limit) {
+    auto percentile = [](std::vector<long long> values, double fraction) {
+        std::sort(values.begin(), values.end());
+        return values[std::min<size_t>(values.size() - 1, values.size() * fraction)];
+    };
+    if (position_cnt <= 0) {
+        return 1;
+    }
+    for (int snake_cnt : StressSnakeCounts) {
+        std::vector<long long> setup_micros, tick_micros;
+        long long depths = 0, nodes = 0;
+        for (int i = 0; i < position_cnt; i++) {
+            std::istringstream input(GenerateStressPosition(snake_cnt, Mix64(snake_cnt * 1000003ull + i)));
+            auto start_time = std::chrono::high_resolution_clock::now();
+            Game game(input);
+            auto should_finish_before = max_depth == INT_MAX && max_nodes == LLONG_MAX ? start_time + std::chrono::milliseconds(millisecond_limit)
+                                                                                      : std::chrono::system_clock::time_point::max();
+            Decision decision = Decide(game, start_time, should_finish_before, max_depth, max_nodes);
+            DrainLog();
+            setup_micros.push_back(decision.SetupMicroseconds);
+            tick_micros.push_back(decision.ElapsedMicroseconds);
+            depths += decision.Depth;
+            nodes += decision.Nodes;
+        }
+        std::cout << snake_cnt << " snakes: setup p50 " << percentile(setup_micros, 0.5) / 1000.0 << "ms, p90 " << percentile(setup_micros, 0.9) / 1000.0
+                  << "ms, p99 " << percentile(setup_micros, 0.99) / 1000.0 << "ms; tick p50 " << percentile(tick_micros, 0.5) / 1000.0 << "ms, p90 "
+                  << percentile(tick_micros, 0.9) / 1000.0 << "ms, p99 " << percentile(tick_micros, 0.99) / 1000.0 << "ms, max "
+                  << percentile(tick_micros, 1.0) / 1000.0 << "ms; avg depth " << (double)depths / position_cnt << ", " << nodes / position_cnt
+                  << " nodes/tick" << std::endl;
+    }
+    return 0;
+}
+
+//
+//  Imagine Verification
+//
+
+// Randomized check of the instantiations ImagineOperations picks against the general rules. Two
+// copies of a crowded position play the same random ticks, with shields, reverses and moves off
+// the map among them, one copy through each path; they are compared after every tick and again
+// once both are revoked back to the start. Half of the positions start without shields, so the
+// paths without shield rules are exercised as well.
+constexpr int VerifyImagineTicks = 24;
+
+bool SameGameState(const Game& a, const Game& b) {
+    if (a.TimeRemain != b.TimeRemain || a.MapHash != b.MapHash || a.SnakeInfos.size() != b.SnakeInfos.size()) {
+        return false;
+    }
+    auto same_point = [](const Point& p, const Point& q) { return p.h == q.h && p.w == q.w; };
+    for (size_t idx = 0; idx < a.SnakeInfos.size(); idx++) {
+        const SnakeInfo& s = a.SnakeInfos[idx];
+        const SnakeInfo& t = b.SnakeInfos[idx];
+        if (s.Alive != t.Alive || s.Score != t.Score || s.LastOperation != t.LastOperation || s.ShieldCD != t.ShieldCD ||
+            s.ShieldET != t.ShieldET || !std::equal(s.Body.begin(), s.Body.end(), t.Body.begin(), t.Body.end(), same_point)) {
+            return false;
+        }
+    }
+    for (int h = 0; h < Height; h++) {
+        for (int w = 0; w < Width; w++) {
+            if (a.Map[h][w].SnakeIdx != b.Map[h][w].SnakeIdx || a.Map[h][w].Obj != b.Map[h][w].Obj) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int VerifyImagine(int position_cnt) {
+    long long ticks = 0, ticks_without_shield_rules = 0, growth_ticks = 0, mismatches = 0;
+    for (int snake_cnt : StressSnakeCounts) {
+        for (int i = 0; i < position_cnt; i++) {
+            const uint64_t seed = Mix64(snake_cnt * 1000003ull + i) ^ 0x5eed;
+            std::mt19937_64 rng(seed);
+            std::istringstream input(GenerateStressPosition(snake_cnt, seed));
+            Game start(input);
+            if (i % 2 == 0) {
+                for (SnakeInfo& snake : start.SnakeInfos) {
+                    snake.ShieldCD = snake.ShieldET = 0;
+                }
+            }
+            Game specialized = start, general = start;
+            const int shield_roll = i % 2 == 0 ? 200 : 10;  // one operation in this many is a shield
+            std::vector<SnakeIdxAndOperation> operations(snake_cnt);
+            int imagined = 0;
+            for (int tick = 0; tick < VerifyImagineTicks && general.TimeRemain > 1; tick++) {
+                bool shield_rules = false;
+                for (int idx = 0; idx < snake_cnt; idx++) {
+                    const SnakeInfo& snake = general.SnakeInfos[idx];
+                    const int roll = std::uniform_int_distribution<int>(0, shield_roll - 1)(rng);
+                    Operation op = (Operation)std::uniform_int_distribution<int>(0, 3)(rng);
+                    if (roll == 0) {
+                        op = Operation::Shield;
+                    } else if (roll % 8 != 1 && op == Reverse(snake.LastOperation)) {
+                        op = snake.LastOperation;
+                    }
+                    operations[idx] = {.Idx = idx, .Op = op};
+                    shield_rules |= op == Operation::Shield || snake.ShieldET > 0;
+                }
+                const bool lucky_tail_for_other_snake = rng() % 2 == 0;
+                ticks++;
+                ticks_without_shield_rules += !shield_rules;
+                growth_ticks += lucky_tail_for_other_snake && (TotalTime - (general.TimeRemain - 1)) % 10 == 0;
+                specialized.ImagineOperations(operations, lucky_tail_for_other_snake);
+                general.ImagineOperationsGeneral(operations, lucky_tail_for_other_snake);
+                imagined++;
+                if (!SameGameState(specialized, general)) {
+                    Log<LogError>() << "Imagine mismatch: " << snake_cnt << " snakes, position " << i << ", tick " << tick;
+                    mismatches++;
+                    break;
+                }
+            }
+            for (; imagined > 0; imagined--) {
+                specialized.RevokeOperations();
+                general.RevokeOperations();
+            }
+            if (!SameGameState(specialized, start) || !SameGameState(general, start)) {
+                Log<LogError>() << "Revoke mismatch: " << snake_cnt << " snakes, position " << i;
+                mismatches++;
+            }
+        }
+    }
+    DrainLog();
+    std::cout << ticks << " ticks verified (" << ticks_without_shield_rules << " without shield rules, " << growth_ticks
+              << " with lucky growth), " << mismatches << " mismatches" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
+
+//
+//  Neural Danger Training
+//
+
+// Trains the danger net on positions of a trace. From every recorded tick a few random
+// continuations of up to NetSampleTicks ticks are played, and each position reached is labelled
+// with the full danger field around our head. The net is trained in floats by SGD on the cross
+// entropy of every inner cell, then quantized; one sample in NetHoldoutEvery is held out to report
+// how often the quantized net gets a cell, and a deadly cell, right.
+constexpr int NetWalksPerRecord = 4;
+constexpr int NetSampleTicks = 3;
+constexpr int NetHoldoutEvery = 10;
+constexpr int NetEpochs = 12;
+constexpr double NetLearningRate = 0.02;
+constexpr double NetWeightLimit = 127.0 / NetOutputScale;  // what the int8 output weights can hold
+
+struct NetSample {
+    int FeatureOffset;
+    int FeatureCnt;
+    int8_t Labels[NetCells];  // class of each inner cell, -1 if the class is not the net's to predict
+};
+
+struct FloatNet {
+    std::vector<float> InputWeights = std::vector<float>(NetInputs * NetHidden);
+    std::vector<float> HiddenBiases = std::vector<float>(NetHidden);
+    std::vector<float> OutputWeights = std::vector<float>(NetOutputs * NetHidden);
+    std::vector<float> OutputBiases = std::vector<float>(NetOutputs);
+
+    NetWeights Quantize() const {
+        NetWeights weights;
+        auto round_to = [](double value, double limit) { return std::clamp(std::round(value), -limit, limit); };
+        for (int i = 0; i < NetInputs * NetHidden; i++) {
+            weights.InputWeights[i / NetHidden][i % NetHidden] = (int16_t)round_to(InputWeights[i] * NetHiddenScale, INT16_MAX);
+        }
+        for (int j = 0; j < NetHidden; j++) {
+            weights.HiddenBiases[j] = (int16_t)round_to(HiddenBiases[j] * NetHiddenScale, INT16_MAX);
+        }
+        for (int i = 0; i < NetOutputs * NetHidden; i++) {
+            weights.OutputWeights[i / NetHidden][i % NetHidden] = (int8_t)round_to(OutputWeights[i] * NetOutputScale, 127);
+        }
+        for (int o = 0; o < NetOutputs; o++) {
+            weights.OutputBiases[o] = (int32_t)round_to(OutputBiases[o] * NetHiddenScale * NetOutputScale, INT32_MAX);
+        }
+        return weights;
+    }
+};
+
+// One SGD step on a sample.
+void TrainNetSample(FloatNet& net, const int* features, const NetSample& sample, float learning_rate) {
+    float pre[NetHidden], hidden[NetHidden];
+    std::copy(net.HiddenBiases.begin(), net.HiddenBiases.end(), pre);
+    for (int i = 0; i < sample.FeatureCnt; i++) {
+        const float* row = &net.InputWeights[features[i] * NetHidden];
+        for (int j = 0; j < NetHidden; j++) {
+            pre[j] += row[j];
+        }
+    }
+    for (int j = 0; j < NetHidden; j++) {
+        hidden[j] = std::clamp(pre[j], 0.0f, 1.0f);
+    }
+    float hidden_gradient[NetHidden] = {};
+    for (int cell = 0; cell < NetCells; cell++) {
+        if (sample.Labels[cell] < 0) {
+            continue;
+        }
+        float logits[NetClasses], max_logit = -1e30f, total = 0;
+        for (int c = 0; c < NetClasses; c++) {
+            const int o = cell * NetClasses + c;
+            logits[c] = net.OutputBiases[o];
+            for (int j = 0; j < NetHidden; j++) {
+                logits[c] += net.OutputWeights[o * NetHidden + j] * hidden[j];
+            }
+            max_logit = std::max(max_logit, logits[c]);
+        }
+        for (int c = 0; c < NetClasses; c++) {
+            logits[c] = std::exp(logits[c] - max_logit);
+            total += logits[c];
+        }
+        for (int c = 0; c < NetClasses; c++) {
+            const int o = cell * NetClasses + c;
+            const float gradient = logits[c] / total - (c == sample.Labels[cell] ? 1.0f : 0.0f);
+            for (int j = 0; j < NetHidden; j++) {
+                hidden_gradient[j] += gradient * net.OutputWeights[o * NetHidden + j];
+                float& weight = net.OutputWeights[o * NetHidden + j];
+                weight = std::clamp<float>(weight - learning_rate * gradient * hidden[j], -NetWeightLimit, NetWeightLimit);
+            }
+            net.OutputBiases[o] -= learning_rate * gradient;
+        }
+    }
+    for (int j = 0; j < NetHidden; j++) {
+        if (pre[j] <= 0 || pre[j] >= 1) {
+            hidden_gradient[j] = 0;
+        }
+        net.HiddenBiases[j] -= learning_rate * hidden_gradient[j];
+    }
+    for (int i = 0; i < sample.FeatureCnt; i++) {
+        float* row = &net.InputWeights[features[i] * NetHidden];
+        for (int j = 0; j < NetHidden; j++) {
+            row[j] -= learning_rate * hidden_gradient[j];
+        }
+    }
+}
+
+int TrainNet(const char* trace_path, const char* net_path) {
+    FILE* file = fopen(trace_path, "rb");
+    if (!file) {
+        Log<LogError>() << "Cannot open trace " << trace_path;
+        return 1;
+    }
+    std::vector<NetSample> samples;
+    std::vector<int> feature_pool;
+    int record_cnt = 0;
+    TraceRecordHeader header;
+    static GameSnapshot snapshot;
+    while (ReadTraceRecord(file, header, snapshot)) {
+        Game game(snapshot);
+        std::mt19937_64 rng(Mix64(record_cnt++));
+        if (game.SelfIdx == EmptyIdx || !game.SnakeInfos[game.SelfIdx].Alive) {
+            continue;
+        }
+        const int snake_cnt = game.SnakeInfos.size();
+        std::vector<SnakeIdxAndOperation> operations(snake_cnt);
+        for (int walk = 0; walk < NetWalksPerRecord; walk++) {
+            int imagined = 0;
+            for (int tick = 0; tick < NetSampleTicks && game.TimeRemain > 1; tick++) {
+                for (int idx = 0; idx < snake_cnt; idx++) {
+                    Operation op = (Operation)std::uniform_int_distribution<int>(0, 3)(rng);
+                    if (op == Reverse(game.SnakeInfos[idx].LastOperation)) {
+                        op = game.SnakeInfos[idx].LastOperation;
+                    }
+                    operations[idx] = {.Idx = idx, .Op = op};
                 }
-                if (DistanceField[h_next][w_next] != -1) {
-                    continue;
+                game.ImagineOperations(operations, rng() % 2 == 0);
+                imagined++;
+                if (!game.SnakeInfos[game.SelfIdx].Alive) {
+                    break;
+                }
+                NetSample sample{.FeatureOffset = (int)feature_pool.size(), .FeatureCnt = 0, .Labels = {}};
+                feature_pool.resize(sample.FeatureOffset + NetInputs);
+                sample.FeatureCnt = NetFeatures(game, &feature_pool[sample.FeatureOffset]);
+                feature_pool.resize(sample.FeatureOffset + sample.FeatureCnt);
+                const Field<DangerValue> danger_field = CreateDangerField(game);
+                DangerValue dangers[NetClasses];
+                NetClassDangers(game, dangers);
+                const Point head = game.SnakeInfos[game.SelfIdx].Body.front();
+                for (int cell = 0; cell < NetCells; cell++) {
+                    const int h = head.h + cell / DangerWindowInnerSize - DangerWindowInnerRadius;
+                    const int w = head.w + cell % DangerWindowInnerSize - DangerWindowInnerRadius;
+                    sample.Labels[cell] = -1;
+                    for (int c = 0; h >= 0 && h < Height && w >= 0 && w < Width && c < NetClasses; c++) {
+                        if (danger_field[h][w] == dangers[c]) {
+                            sample.Labels[cell] = c;
+                            break;
+                        }
+                    }
                 }
-                updater({h_next, w_next}, DistanceField[h][w] + 1);
+                samples.push_back(sample);
             }
-        });
-    return DistanceField;
-}
+            for (; imagined > 0; imagined--) {
+                game.RevokeOperations();
+            }
+        }
+    }
+    fclose(file);
 
-Field<double> CreateSpreadableField(Game& game, Point point, double spreadable_value) {
-    return CreateDistanceField(game, point).Map([spreadable_value](int distance) {
-        if (distance == -1) {
-            return 0.0;
+    std::vector<int> training, holdout;
+    for (int i = 0; i < (int)samples.size(); i++) {
+        (i % NetHoldoutEvery == 0 ? holdout : training).push_back(i);
+    }
+    FloatNet net;
+    std::mt19937_64 rng(NetMagic);
+    std::uniform_real_distribution<float> initial(-0.1f, 0.1f);
+    for (float& weight : net.InputWeights) {
+        weight = initial(rng);
+    }
+    for (float& weight : net.OutputWeights) {
+        weight = initial(rng);
+    }
+    std::fill(net.HiddenBiases.begin(), net.HiddenBiases.end(), 0.5f);
+    for (int epoch = 0; epoch < NetEpochs; epoch++) {
+        std::shuffle(training.begin(), training.end(), rng);
+        const float learning_rate = NetLearningRate * (NetEpochs - epoch) / NetEpochs;
+        for (int i : training) {
+            TrainNetSample(net, &feature_pool[samples[i].FeatureOffset], samples[i], learning_rate);
         }
-        return spreadable_value / (distance + 1);
-    });
-}
+    }
 
-Field<double> CreateObjectValueField(Game& game, const Field<double>& DangerField) {
-    const int my_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
-    const int my_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
-    std::vector<Field<double>> RawObjectFields;
-    for (int h = 0; h < Height; h++) {
-        for (int w = 0; w < Width; w++) {
-            double spreadable_value = 0;
-            Cell cell = game.Map[h][w];
-            if (DangerField[h][w] < 0)
+    const NetWeights weights = net.Quantize();
+    long long cells = 0, right = 0, deadly = 0, deadly_found = 0, predicted_deadly = 0, predicted_deadly_right = 0, windows_right = 0;
+    for (int i : holdout) {
+        int classes[NetCells];
+        NeuralDanger::Classify(weights, &feature_pool[samples[i].FeatureOffset], samples[i].FeatureCnt, classes);
+        bool window_right = true;
+        for (int cell = 0; cell < NetCells; cell++) {
+            const int label = samples[i].Labels[cell];
+            if (label < 0) {
                 continue;
-            if (cell.Obj > ScoreZero && cell.Obj < ScoreTooLarge) {
-                spreadable_value = BaseValueOfScore + ValuePerScore * (cell.Obj - ScoreZero);
-            }
-            if (cell.Obj == Length) {
-                spreadable_value = ValueOfLengthAtBegin * (double)game.TimeRemain / TotalTime + ValueOfLengthAtEnd * (1 - (double)game.TimeRemain / TotalTime);
-            }
-            if (spreadable_value != 0) {
-                RawObjectFields.push_back(CreateSpreadableField(game, {.h = h, .w = w}, spreadable_value));
             }
+            cells++;
+            right += classes[cell] == label;
+            window_right &= classes[cell] == label;
+            deadly += label == 1;
+            deadly_found += label == 1 && classes[cell] == 1;
+            predicted_deadly += classes[cell] == 1;
+            predicted_deadly_right += label == 1 && classes[cell] == 1;
         }
+        windows_right += window_right;
+    }
+    std::cout << samples.size() << " samples from " << record_cnt << " records, " << holdout.size() << " held out: "
+              << 100.0 * right / std::max(1LL, cells) << "% of cells and " << 100.0 * windows_right / std::max<size_t>(1, holdout.size())
+              << "% of windows right, deadly cells " << 100.0 * deadly_found / std::max(1LL, deadly) << "% found, "
+              << 100.0 * predicted_deadly_right / std::max(1LL, predicted_deadly) << "% of predicted ones deadly" << std::endl;
+    if (!NeuralDanger::Save(net_path, weights)) {
+        Log<LogError>() << "Failed to write net " << net_path;
+        return 1;
     }
+    return 0;
+}
 
-    Field<double> SumField(0);
-    for (auto& Field : RawObjectFields) {
-        SumField = SumField + Field;
+//
+//  Tournament
+//
+
+// Full games between builds of the bot, each move asked of a fresh process on the stdin/stdout
+// protocol as the judge does, on as many concurrent games as there are cores. The referee plays
+// the rules as Game imagines them, with the judge's setup from game.js: snakes of length 5 on a
+// circle around the center, a ring of walls, and objects refilled every ten ticks ever closer to
+// the center. A bot that crashes, answers garbage or overruns the move limit is eliminated. Every
+// two snakes of different builds in a game count as a pairing, won on final score, for Elo and
+// for an SPRT of the first build against the second; pairings of one game are correlated, so
+// the error bars are on the optimistic side.
+constexpr int TournamentSeats = 8;
+constexpr int TournamentMoveMillisecondLimit = 200;  // the judge's limit; the bot budgets 150 of it
+constexpr int TournamentTicks = 255;
+constexpr int TournamentStartLength = 5;
+constexpr int TournamentStartShieldET = 10;
+constexpr int TournamentObjectCount = 68;
+constexpr int TournamentObjectRefillTicks = 10;
+constexpr ObjType TournamentObjectTypes[] = {ScoreOne, ScoreTwo, ScoreThree, ScoreFive, Length, Trap};  // equally likely
+constexpr double SprtElo0 = 0;
+constexpr double SprtElo1 = 5;
+constexpr double SprtAlpha = 0.05;
+constexpr double SprtBeta = 0.05;
+
+struct BotAnswer {
+    std::optional<Operation> Op;  // none if the bot failed
+    long long Microseconds;
+    bool TimedOut;
+};
+
+// Runs `command` (a path and arguments separated by spaces) on `position` and reads its
+// operation, killing it once `millisecond_limit` has passed.
+BotAnswer AskBot(const std::string& command, const std::string& position, int millisecond_limit) {
+    std::vector<std::string> args;
+    std::istringstream command_input(command);
+    for (std::string arg; command_input >> arg;) {
+        args.push_back(arg);
     }
-    Field<double> StandardlizedSumField = SumField.Standardlize(1.0);
-    Field<int> CenterDistanceField = CreateDistanceField(game, {.h = CenterH, .w = CenterW});
+    std::vector<char*> argv;
+    for (std::string& arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
 
-    Field<double> ObjectValueField(0);
-    for (auto& Field : RawObjectFields) {
-        double field_weight = 1.0;
-        double field_value_at_my_pos = Field[my_h][my_w];
-        field_weight *= std::pow(field_value_at_my_pos / (SumField[my_h][my_w] / RawObjectFields.size()), LockOnCoefficient);
-        field_weight *= StandardlizedSumField[my_h][my_w];
-        field_weight *= 1.0 - DeclineOfObjectValueAtEdge * (double)CenterDistanceField[my_h][my_w] / RadiusOfMap;
-        for (SnakeInfo& snake : game.SnakeInfos) {
-            if (!snake.Alive || snake.Idx == game.SelfIdx) {
-                continue;
-            }
-            double field_value_at_opponent_pos = Field[snake.Body.front().h][snake.Body.front().w];
-            if (field_value_at_opponent_pos >= field_value_at_my_pos) {
-                field_weight *= BaseDeclineOfCompetitivity * (field_value_at_my_pos / field_value_at_opponent_pos);
-            }
+    auto start_time = std::chrono::steady_clock::now();
+    auto elapsed_micros = [&]() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    };
+    int input_pipe[2], output_pipe[2];
+    if (args.empty() || pipe2(input_pipe, O_CLOEXEC) != 0) {
+        return BotAnswer{.Microseconds = 0, .TimedOut = false};
+    }
+    if (pipe2(output_pipe, O_CLOEXEC) != 0) {
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        return BotAnswer{.Microseconds = 0, .TimedOut = false};
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, input_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, output_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    const bool spawned = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ) == 0;
+    posix_spawn_file_actions_destroy(&actions);
+    close(input_pipe[0]);
+    close(output_pipe[1]);
+    if (!spawned) {
+        close(input_pipe[1]);
+        close(output_pipe[0]);
+        return BotAnswer{.Microseconds = elapsed_micros(), .TimedOut = false};
+    }
+
+    // positions are far below a pipe's capacity, so writing never waits on the bot reading
+    for (size_t written = 0; written < position.size();) {
+        const ssize_t cnt = write(input_pipe[1], position.data() + written, position.size() - written);
+        if (cnt <= 0) {
+            break;
         }
-        ObjectValueField = ObjectValueField.MaxWith(Field * field_weight);
+        written += cnt;
     }
-    ObjectValueField = ObjectValueField * CorrectionForSpreadableFields;
-    for (int h = 0; h < Height; h++) {
-        for (int w = 0; w < Width; w++) {
-            Cell cell = game.Map[h][w];
-            if (cell.Obj == Trap) {
-                ObjectValueField[h][w] += ValueOfTrap;
-            }
+    close(input_pipe[1]);
+
+    std::string output;
+    bool timed_out = false;
+    while (output.find('\n') == std::string::npos) {
+        const long long micros_left = millisecond_limit * 1000ll - elapsed_micros();
+        pollfd fd{.fd = output_pipe[0], .events = POLLIN, .revents = 0};
+        if (micros_left <= 0 || poll(&fd, 1, (micros_left + 999) / 1000) == 0) {
+            timed_out = true;
+            break;
         }
+        char buffer[256];
+        const ssize_t cnt = read(output_pipe[0], buffer, sizeof(buffer));
+        if (cnt <= 0) {
+            break;
+        }
+        output.append(buffer, cnt);
     }
-    return ObjectValueField;
+    const long long micros = elapsed_micros();
+    close(output_pipe[0]);
+    kill(pid, SIGKILL);  // only the first line counts, and the bot has nothing left to do after it
+    waitpid(pid, nullptr, 0);
+
+    BotAnswer answer{.Microseconds = micros, .TimedOut = timed_out};
+    int op;
+    if (!timed_out && std::istringstream(output) >> op && op >= Left && op <= Shield) {
+        answer.Op = (Operation)op;
+    }
+    return answer;
 }
 
-Field<double> CreateCenterValueField(Game& game) {
-    const int tick = TotalTime - game.TimeRemain;
-    const double time_percentage = ((double)tick - TickCenterValueBegin) / (TickCenterValueEnd - TickCenterValueBegin);
-    const double ValueOfCenter = time_percentage * ValueOfCenterAtEnd + (1 - time_percentage) * ValueOfCenterWhenEmerge;
-    Field<double> CenterValueField;
-    Field<int> DistanceField = CreateDistanceField(game, {.h = CenterH, .w = CenterW});
-    const int radius_of_center = 5;
+// The position as the snake in `viewer` seat receives it: its own snake carries SelfName and the
+// others their seat number.
+std::string TournamentPosition(const Game& game, int viewer) {
+    std::ostringstream output;
+    output << game.TimeRemain << "\n";
+    std::vector<std::pair<Point, int>> objects;
     for (int h = 0; h < Height; h++) {
         for (int w = 0; w < Width; w++) {
-            int radius = DistanceField[h][w];
-            double value = radius <= radius_of_center ? (ValueOfCenter + ValueOnlyInCenter) : ValueOfCenter * ((double)radius - RadiusOfMap) / (radius_of_center - RadiusOfMap);
-            CenterValueField[h][w] = value;
+            const ObjType obj = game.Map[h][w].Obj;
+            if (obj != None && obj != ScoreZero) {
+                objects.push_back({{h, w}, obj == Wall ? -4 : obj == Trap ? -2 : obj == Length ? -1 : obj - ScoreZero});
+            }
         }
     }
-    for (int h = 0; h < Height; h++) {
-        for (int w = 0; w < Width; w++) {
-            const int longer = std::max(std::abs(h - CenterH), std::abs(w - CenterW));
-            const int shorter = std::min(std::abs(h - CenterH), std::abs(w - CenterW));
-            bool in_center = (longer <= 5 && shorter <= 2) || (longer <= 4 && shorter <= 4);
-            if (in_center) {
-                CenterValueField[h][w] = ValueOfCenter + ValueOnlyInCenter;
-            }
+    output << objects.size() << "\n";
+    for (const auto& [point, type_idx] : objects) {
+        output << point.h << " " << point.w << " " << type_idx << "\n";
+    }
+    output << std::count_if(game.SnakeInfos.begin(), game.SnakeInfos.end(), [](const SnakeInfo& snake) { return snake.Alive; }) << "\n";
+    for (const SnakeInfo& snake : game.SnakeInfos) {
+        if (!snake.Alive) {
+            continue;
+        }
+        output << (snake.Idx == viewer ? SelfName : snake.Idx + 1) << " " << snake.Body.size() << " " << snake.Score << " "
+               << snake.LastOperation << " " << snake.ShieldCD << " " << snake.ShieldET << "\n";
+        for (const Point& point : snake.Body) {
+            output << point.h << " " << point.w << "\n";
         }
     }
-    return CenterValueField;
+    return output.str();
 }
 
-Field<double> CreateValueFieldWithoutDangerField(Game& game) {
-    const int tick = TotalTime - game.TimeRemain;
-    Field<double> DangerField = CreateDangerField(game);
-    Field<double> ObjectValueField = CreateObjectValueField(game, DangerField);
-    Field<double> CenterValueField = (tick >= TickCenterValueBegin && tick <= TickCenterValueEnd) ? CreateCenterValueField(game) : Field<double>(0);
-    Field<double> ValueFieldWithoutDangerField = ObjectValueField + CenterValueField;
+// Math.round of the judge, which rounds halves up.
+int RoundLikeJudge(double value) {
+    return (int)std::floor(value + 0.5);
+}
 
-    std::cerr << "Danger Field:" << std::endl;
-    DangerField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-    std::cerr << "Object Value Field:" << std::endl;
-    ObjectValueField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-    std::cerr << "Center Value Field:" << std::endl;
-    CenterValueField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-    std::cerr << "Value Field Without Danger Field:" << std::endl;
-    ValueFieldWithoutDangerField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-    std::cerr << "Map:" << std::endl;
-    game.PrintMapNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 10);
-
-    return ValueFieldWithoutDangerField;
+// Places the missing objects on free cells of a window around the center that narrows with
+// `tick`, as update_bonus does; `object_cells` are the cells objects were placed on.
+void RefillTournamentObjects(Game& game, std::vector<Point>& object_cells, int tick, std::mt19937_64& rng) {
+    // the judge's pixel geometry: 20 pixels a cell, objects at offset 13
+    const double center_x = 13 + Width * 20 / 2, center_y = 13 + Height * 20 / 2;
+    const double offset_x = std::max(100.0, center_x - tick * 1.5), offset_y = std::max(100.0, center_y - tick * 1.5);
+    const double min_x = std::max(0.0, center_x - offset_x), max_x = std::min(Width * 20 - 20.0, center_x + offset_x);
+    const double min_y = std::max(0.0, center_y - offset_y), max_y = std::min(Height * 20 - 20.0, center_y + offset_y);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_int_distribution<int> type(0, std::size(TournamentObjectTypes) - 1);
+    for (Point& cell : object_cells) {
+        if (game.Map[cell.h][cell.w].Obj != None) {
+            continue;
+        }
+        for (int attempt = 0; attempt < 1000; attempt++) {
+            const int w = (int)std::floor((min_x + unit(rng) * (max_x - min_x)) / 20);
+            const int h = (int)std::floor((min_y + unit(rng) * (max_y - min_y)) / 20);
+            if (game.Map[h][w].Obj == None) {
+                game.Map[h][w].Obj = TournamentObjectTypes[type(rng)];
+                cell = Point{.h = h, .w = w};
+                break;
+            }
+        }
+    }
+    game.RehashMap();
 }
 
-//
-//  DFS Search
-//
+struct TournamentSeat {
+    int Bot;
+    int Score = 0;
+    std::vector<long long> Micros;
+    int Timeouts = 0, Failures = 0;
+};
 
-double UtilityOfMyMove(Game& game,
-                       Operation operation,
-                       const Field<double>& ValueField,
-                       const Field<double>& ValueFieldWithoutDangerField,
-                       int depth,
-                       std::chrono::system_clock::time_point should_finish_before,
-                       bool enable_debug = false) {
-    if (std::chrono::high_resolution_clock::now() > should_finish_before) {
-        throw NoTimeRemainException();
+// Plays one game and returns its seats with their final scores.
+std::vector<TournamentSeat> PlayTournamentGame(const std::vector<std::string>& bots, int game_idx, int seat_cnt, int move_millisecond_limit) {
+    std::mt19937_64 rng(Mix64(game_idx + 1));
+    std::vector<TournamentSeat> seats(seat_cnt);
+    for (int seat = 0; seat < seat_cnt; seat++) {
+        seats[seat].Bot = (game_idx + seat) % bots.size();
     }
 
-    const int snake_cnt = game.SnakeInfos.size();
-    const int my_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
-    const int my_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
-
-    // find all snakes in gambling radius
-    const int GamblingRadius = 2 * depth;
-    std::vector<int> gambling_snake_idxs;
-    for (SnakeInfo& snake : game.SnakeInfos) {
-        if (!snake.Alive || snake.Idx == game.SelfIdx) {
-            continue;
+    // snakes evenly on a circle of radius 10 around the center, in random order, each heading
+    // along the circle as add_snake's caller sets them up; walls on a ring of radius 6
+    std::ostringstream start;
+    start << TournamentTicks << "\n";
+    std::vector<std::pair<Point, int>> walls;
+    constexpr int WallPointCnt = 36;
+    for (int j = 0; j < WallPointCnt; j++) {
+        const double radians = j * 2 * M_PI / WallPointCnt;
+        const int w = RoundLikeJudge(Width / 2 + 6 * std::cos(radians));
+        const int h = RoundLikeJudge(Height / 2 + 6 * std::sin(radians));
+        if (w != Width / 2 && h != Height / 2) {
+            walls.push_back({{h, w}, -4});
         }
-        const int distance = std::abs(snake.Body.front().h - my_h) + std::abs(snake.Body.front().w - my_w);
-        if (distance <= GamblingRadius) {
-            gambling_snake_idxs.push_back(snake.Idx);
+    }
+    start << walls.size() << "\n";
+    for (const auto& [point, type_idx] : walls) {
+        start << point.h << " " << point.w << " " << type_idx << "\n";
+    }
+    std::vector<int> order(seat_cnt);
+    for (int seat = 0; seat < seat_cnt; seat++) {
+        order[seat] = seat;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+    std::vector<std::string> snake_lines(seat_cnt);
+    for (int k = 0; k < seat_cnt; k++) {
+        const double theta = k * 2 * M_PI / seat_cnt;
+        const int head_w = RoundLikeJudge((403 + 200 * std::cos(theta)) / 20);
+        const int head_h = RoundLikeJudge((303 + 200 * std::sin(theta)) / 20);
+        const Operation heading = theta < M_PI / 2 ? Left : theta < M_PI ? Up : theta < 3 * M_PI / 2 ? Right : Down;
+        std::ostringstream line;
+        line << order[k] + 1 << " " << TournamentStartLength << " 0 " << heading << " 0 " << TournamentStartShieldET << "\n";
+        for (int j = 0; j < TournamentStartLength; j++) {
+            line << std::clamp(head_h - j * DhOfOperation(heading), 0, Height - 1) << " "
+                 << std::clamp(head_w - j * DwOfOperation(heading), 0, Width - 1) << "\n";
         }
+        snake_lines[order[k]] = line.str();
     }
-    const int gambling_snake_cnt = gambling_snake_idxs.size();
+    start << seat_cnt << "\n";
+    for (const std::string& line : snake_lines) {
+        start << line;
+    }
+    std::istringstream start_input(start.str());
+    Game game(start_input);
 
-    // enumerate all possible operations for gambling snakes, and use default operation for others
-    std::list<std::vector<Operation>> operation_collections;
-    if (gambling_snake_cnt == 0) {
-        // no need to enumerate
-        operation_collections.push_back(std::vector<Operation>(snake_cnt, Invalid));
-    } else {
-        std::vector<int> enumerate_stack(gambling_snake_cnt, 0);
-        while (true) {
-            // check if valid
-            bool is_valid = true;
-            for (int i = 0; i < gambling_snake_cnt; i++) {
-                if (game.SnakeInfos[gambling_snake_idxs[i]].LastOperation == Reverse(AllOperations[enumerate_stack[i]])) {
-                    is_valid = false;
-                    break;
-                }
+    // the first objects go one per column band, each at a random free row
+    std::vector<Point> object_cells;
+    for (int i = 0; i < TournamentObjectCount; i++) {
+        const int w = (int)std::floor(i * ((Width * 20 - 20.0) / TournamentObjectCount) / 20);
+        for (int attempt = 0; attempt < 1000; attempt++) {
+            const int h = std::uniform_int_distribution<int>(0, Height - 2)(rng);
+            if (game.Map[h][w].Obj == None) {
+                game.Map[h][w].Obj = TournamentObjectTypes[std::uniform_int_distribution<int>(0, std::size(TournamentObjectTypes) - 1)(rng)];
+                object_cells.push_back(Point{.h = h, .w = w});
+                break;
             }
+        }
+    }
+    game.RehashMap();
 
-            // collect
-            if (is_valid) {
-                operation_collections.push_back(std::vector<Operation>(snake_cnt, Invalid));
-                std::vector<Operation>& operations = operation_collections.back();
-                for (int i = 0; i < gambling_snake_cnt; i++) {
-                    operations[gambling_snake_idxs[i]] = AllOperations[enumerate_stack[i]];
-                }
+    std::vector<SnakeIdxAndOperation> operations;
+    for (int tick = 1; tick <= TournamentTicks; tick++) {
+        operations.clear();
+        for (int seat = 0; seat < seat_cnt; seat++) {
+            const SnakeInfo& snake = game.SnakeInfos[seat];
+            if (!snake.Alive) {
+                continue;
             }
-
-            // next
-            int i = gambling_snake_cnt - 1;
-            while (i >= 0 && enumerate_stack[i] == AllOperationCount - 1) {
-                enumerate_stack[i] = 0;
-                i--;
+            const BotAnswer answer = AskBot(bots[seats[seat].Bot], TournamentPosition(game, seat), move_millisecond_limit);
+            seats[seat].Micros.push_back(answer.Microseconds);
+            seats[seat].Timeouts += answer.TimedOut;
+            if (!answer.Op) {
+                seats[seat].Failures++;
+                game.ImagineElimination(seat);
+                continue;
             }
-            if (i < 0) {
-                break;
+            // the judge keeps going straight on a reverse or on a shield it will not grant
+            Operation op = *answer.Op;
+            if (op == Reverse(snake.LastOperation) || (op == Shield && (snake.ShieldCD > 0 || snake.Score < ShieldCost))) {
+                op = snake.LastOperation;
             }
-            enumerate_stack[i]++;
+            operations.push_back({.Idx = seat, .Op = op});
         }
-    }
-    for (auto& item : operation_collections) {
-        for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
-            if (snake_idx == game.SelfIdx) {
-                item[snake_idx] = operation;
-            } else {
-                if (item[snake_idx] == Invalid)
-                    item[snake_idx] = game.SnakeInfos[snake_idx].LastOperation;
+        if (operations.empty()) {
+            break;
+        }
+        game.ImagineOperations(operations, false);
+        for (const auto& op : operations) {
+            if (op.Op != Shield) {
+                game.SnakeInfos[op.Idx].LastOperation = op.Op;
             }
         }
+        if (tick % TournamentObjectRefillTicks == 0) {
+            RefillTournamentObjects(game, object_cells, tick, rng);
+        }
+    }
+    for (int seat = 0; seat < seat_cnt; seat++) {
+        seats[seat].Score = game.SnakeInfos[seat].Score;
     }
+    return seats;
+}
 
-    // simulate
-    std::valarray<double> utility_for_each_case(operation_collections.size());
-    int case_idx = 0;
-    for (std::vector<Operation>& operations : operation_collections) {
-        std::vector<SnakeIdxAndOperation> snake_operations;
-        for (int snake_idx = 0; snake_idx < snake_cnt; snake_idx++) {
-            snake_operations.push_back({.Idx = snake_idx, .Op = operations[snake_idx]});
-        }
-        const int score_before = game.SnakeInfos[game.SelfIdx].Score;
-        game.ImagineOperations(snake_operations, true);
-        const int new_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
-        const int new_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
-        Field<double> NewDangerField = CreateDangerField(game);
-        Field<double> ValueFieldWithNewDangerField = ValueFieldWithoutDangerField.MinWith(NewDangerField);
-        int gambling_shield_count_before = 0;
-        for (int snake_idx : gambling_snake_idxs) {
-            if (game.SnakeInfos[snake_idx].ShieldET > 1 && game.SnakeInfos[snake_idx].Name != 2023202303) {
-                gambling_shield_count_before++;
-            }
-        }
+struct PairingRecord {
+    long long Wins = 0, Draws = 0, Losses = 0;
 
-        // evaluate
-        SnakeInfo& self = game.SnakeInfos[game.SelfIdx];
-        const double score_utility = UtilityPerScore * (self.Score - score_before);
-        const double use_shield_utility = operation == Shield ? UtilityOfShield : 0;
-        double death_utility = 0, current_value_utility = 0, future_value_utility = 0,
-               opponent_shield_utility = 0, opponent_death_utility = 0, dfs_utility = 0;
-        if (!self.Alive) {
-            // check head to head die
-            bool head_to_head_die = false;
-            for (int snake_idx : gambling_snake_idxs) {
-                if (game.SnakeInfos[snake_idx].Body.front().h == new_h && game.SnakeInfos[snake_idx].Body.front().w == new_w) {
-                    head_to_head_die = true;
-                    break;
-                }
-            }
-            death_utility = UtilityPerValue * ValueOfDeathPerRemainTime * game.TimeRemain * (head_to_head_die ? PenaltyDeclineOfHeadToHeadDeath : 1);
-        } else {
-            // have not stepped into danger zone
-            current_value_utility = UtilityPerValue * ValueField[new_h][new_w];
+    long long Games() const { return Wins + Draws + Losses; }
+    double ScoreRate() const { return (Wins + Draws / 2.0) / Games(); }
+    double Variance() const {
+        const double s = ScoreRate();
+        return (Wins * (1 - s) * (1 - s) + Draws * (0.5 - s) * (0.5 - s) + Losses * s * s) / Games();
+    }
+};
 
-            // can step into a safe zone
-            double max_value = VerySmallValue;
-            for (Operation direction : {Operation::Left, Operation::Up, Operation::Right, Operation::Down}) {
-                if (direction == Reverse(operation)) {
-                    continue;
-                }
-                int h_next = new_h + DhOfOperation(direction);
-                int w_next = new_w + DwOfOperation(direction);
-                if (h_next < 0 || h_next >= Height || w_next < 0 || w_next >= Width) {
-                    continue;
-                }
-                max_value = std::min(0.0, std::max(max_value, NewDangerField[h_next][w_next]));
-            }
-            future_value_utility = DeclinePerDepth * UtilityPerValue * max_value;
+double EloOfScoreRate(double rate) {
+    rate = std::clamp(rate, 1e-6, 1 - 1e-6);
+    return 400 * std::log10(rate / (1 - rate));
+}
 
-            // shield
-            int gambling_shield_count_after = 0;
-            for (int snake_idx : gambling_snake_idxs) {
-                if (game.SnakeInfos[snake_idx].ShieldET > 0 && game.SnakeInfos[snake_idx].Name != 2023202303) {
-                    gambling_shield_count_after++;
-                }
-            }
-            opponent_shield_utility = UtilityOfShield * (gambling_shield_count_after - gambling_shield_count_before);
+// Log-likelihood ratio of elo1 against elo0, in the normal approximation of the trinomial.
+double SprtLlr(const PairingRecord& record, double elo0, double elo1) {
+    const double variance = record.Variance();
+    if (record.Games() == 0 || variance <= 0) {
+        return 0;
+    }
+    const double s0 = 1 / (1 + std::pow(10, -elo0 / 400)), s1 = 1 / (1 + std::pow(10, -elo1 / 400));
+    return record.Games() * (s1 - s0) * (2 * record.ScoreRate() - s0 - s1) / (2 * variance);
+}
 
-            // kill
-            for (int idx : gambling_snake_idxs) {
-                if (!game.SnakeInfos[idx].Alive && game.SnakeInfos[idx].Name != 2023202303) {
-                    opponent_death_utility += UtilityOfOpponentDeath;
+// Plays up to `game_cnt` games of `bots` on `thread_cnt` concurrent games (all cores if 0), and
+// stops early once the SPRT of the first two bots decides.
+int RunTournament(const std::vector<std::string>& bots, int game_cnt, int seat_cnt, int thread_cnt, int move_millisecond_limit) {
+    if (bots.empty() || game_cnt <= 0 || seat_cnt < 2) {
+        return 1;
+    }
+    if (thread_cnt <= 0) {
+        thread_cnt = std::max(1u, std::thread::hardware_concurrency());
+    }
+    signal(SIGPIPE, SIG_IGN);  // a bot may die before reading its position
+    const int bot_cnt = bots.size();
+    const double llr_lower = std::log(SprtBeta / (1 - SprtAlpha)), llr_upper = std::log((1 - SprtBeta) / SprtAlpha);
+    std::mutex mutex;
+    std::vector<std::vector<PairingRecord>> records(bot_cnt, std::vector<PairingRecord>(bot_cnt));
+    std::vector<std::vector<long long>> micros(bot_cnt);
+    std::vector<long long> timeouts(bot_cnt), failures(bot_cnt), scores(bot_cnt), seat_cnts(bot_cnt);
+    std::atomic<bool> decided{false};
+    std::atomic<int> played{0};
+    auto start_time = std::chrono::steady_clock::now();
+    ParallelFor(game_cnt, thread_cnt, [&](int game_idx) {
+        if (decided.load(std::memory_order_relaxed)) {
+            return;
+        }
+        const std::vector<TournamentSeat> seats = PlayTournamentGame(bots, game_idx, seat_cnt, move_millisecond_limit);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const TournamentSeat& seat : seats) {
+            micros[seat.Bot].insert(micros[seat.Bot].end(), seat.Micros.begin(), seat.Micros.end());
+            timeouts[seat.Bot] += seat.Timeouts;
+            failures[seat.Bot] += seat.Failures;
+            scores[seat.Bot] += seat.Score;
+            seat_cnts[seat.Bot]++;
+            for (const TournamentSeat& other : seats) {
+                if (other.Bot != seat.Bot) {
+                    PairingRecord& record = records[seat.Bot][other.Bot];
+                    (seat.Score > other.Score ? record.Wins : seat.Score == other.Score ? record.Draws : record.Losses)++;
                 }
             }
-
-            // dfs
-            if (depth > 0) {
-                std::valarray<double> utilities(AllOperationCount);
-                for (int i = 0; i < AllOperationCount; i++) {
-                    if (game.CanOperate(game.SelfIdx, AllOperations[i]))
-                        utilities[i] = UtilityOfMyMove(
-                            game, AllOperations[i], ValueFieldWithNewDangerField,
-                            ValueFieldWithoutDangerField, depth - 1, should_finish_before);
-                    else
-                        utilities[i] = UtilityPerValue * ValueOfDeathPerRemainTime * game.TimeRemain;
-                }
-                dfs_utility = DeclinePerDepth * utilities.max();
+        }
+        const int game_no = ++played;
+        std::cout << "Game " << game_idx << " done (" << game_no << " played):";
+        for (const TournamentSeat& seat : seats) {
+            std::cout << " " << seat.Bot << ":" << seat.Score;
+        }
+        if (bot_cnt >= 2) {
+            const double llr = SprtLlr(records[0][1], SprtElo0, SprtElo1);
+            std::cout << ", LLR " << llr;
+            if (llr <= llr_lower || llr >= llr_upper) {
+                decided = true;
             }
         }
+        std::cout << std::endl;
+    });
 
-        const double utility = score_utility + use_shield_utility + death_utility +
-                               current_value_utility + future_value_utility +
-                               opponent_shield_utility + opponent_death_utility + dfs_utility;
-
-        if (enable_debug) {
-            std::cerr << "Depth: " << depth << ", Case: " << case_idx << std::endl;
-            std::cerr << "Operation: " << operation << std::endl;
-            std::cerr << "Imagined Map:" << std::endl;
-            game.PrintMapNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 10);
-            std::cerr << "Previous Value Field:" << std::endl;
-            ValueField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-            std::cerr << "Current Value Field:" << std::endl;
-            ValueFieldWithNewDangerField.PrintValuesNearby(game.SnakeInfos[game.SelfIdx].Body.front(), 3);
-            std::cerr << "Utility: " << utility << std::endl;
-            std::cerr << " - Score Utility: " << score_utility << ", Use Shield Utility: " << use_shield_utility << ", Death Utility: " << death_utility << std::endl;
-            std::cerr << " - Current Value Utility: " << current_value_utility << ", Future Value Utility: " << future_value_utility << std::endl;
-            std::cerr << " - Opponent Shield Utility: " << opponent_shield_utility << ", Opponent Death Utility: " << opponent_death_utility << std::endl;
-            std::cerr << " - DFS Utility: " << dfs_utility << std::endl;
-            std::cerr << std::endl;
+    auto percentile = [](std::vector<long long> values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
         }
-
-        utility_for_each_case[case_idx] = utility;
-        game.RevokeOperations();
-        case_idx++;
+        std::sort(values.begin(), values.end());
+        return values[std::min<size_t>(values.size() - 1, values.size() * fraction)] / 1000.0;
+    };
+    const long long wall_seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << played << " games of " << seat_cnt << " seats in " << wall_seconds << "s" << std::endl;
+    for (int bot = 0; bot < bot_cnt; bot++) {
+        std::cout << "Bot " << bot << " (" << bots[bot] << "): avg score " << (seat_cnts[bot] ? (double)scores[bot] / seat_cnts[bot] : 0.0)
+                  << "; move p50 " << percentile(micros[bot], 0.5) << "ms, p90 " << percentile(micros[bot], 0.9) << "ms, p99 "
+                  << percentile(micros[bot], 0.99) << "ms, max " << percentile(micros[bot], 1.0) << "ms; " << timeouts[bot] << " timeouts, "
+                  << failures[bot] << " eliminations" << std::endl;
+        for (int other = 0; other < bot_cnt; other++) {
+            const PairingRecord& record = records[bot][other];
+            if (other == bot || record.Games() == 0) {
+                continue;
+            }
+            // 95% bounds of the score rate, carried over to Elo
+            const double margin = 1.96 * std::sqrt(record.Variance() / record.Games());
+            std::cout << "  vs bot " << other << ": +" << record.Wins << " =" << record.Draws << " -" << record.Losses << ", Elo "
+                      << EloOfScoreRate(record.ScoreRate()) << " [" << EloOfScoreRate(record.ScoreRate() - margin) << ", "
+                      << EloOfScoreRate(record.ScoreRate() + margin) << "]" << std::endl;
+        }
+    }
+    if (bot_cnt >= 2) {
+        const double llr = SprtLlr(records[0][1], SprtElo0, SprtElo1);
+        std::cout << "SPRT bot 0 vs bot 1, Elo " << SprtElo0 << " vs " << SprtElo1 << ": LLR " << llr << " in (" << llr_lower << ", " << llr_upper
+                  << "), " << (llr >= llr_upper ? "H1 accepted" : llr <= llr_lower ? "H0 accepted" : "undecided") << std::endl;
     }
-    return utility_for_each_case.min();
+    return 0;
 }
 
 //
 //  Main Function
 //
 
-int main() {
+#ifndef SNAKE_LIBRARY
+int main(int argc, char* argv[]) {
     auto start_time = std::chrono::high_resolution_clock::now();
     auto should_finish_before = start_time + std::chrono::milliseconds(ExecutionMillisecondLimit);
     std::ios::sync_with_stdio(false);
 
-    Game game = Game();
-
-    Field<double> ValueFieldWithoutDangerField = CreateValueFieldWithoutDangerField(game);
-    Field<double> ValueField = ValueFieldWithoutDangerField.MinWith(CreateDangerField(game));
-    std::vector<std::vector<Operation>> best_operations_by_depth;
-    int depth = 0;
-    try {
-        while (depth <= game.TimeRemain) {
-            best_operations_by_depth.push_back(std::vector<Operation>());
-            double best_utility = VerySmallValue;
-            for (Operation operation : AllOperations) {
-                if (!game.CanOperate(game.SelfIdx, operation)) {
-                    continue;
-                }
-                double utility = UtilityOfMyMove(game, operation, ValueField, ValueFieldWithoutDangerField, depth, should_finish_before);
-                std::cerr << "Depth: " << depth << ", Operation: " << operation << ", Utility: " << utility << std::endl;
-                if (utility > best_utility) {
-                    best_utility = utility;
-                    best_operations_by_depth[depth].clear();
-                    best_operations_by_depth[depth].push_back(operation);
-                } else if (utility == best_utility) {
-                    best_operations_by_depth[depth].push_back(operation);
-                }
-            }
-            std::cerr << "Depth " << depth << " finished, current time: " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count() << "ms" << std::endl;
-            depth++;
+    const char* record_path = std::getenv("SNAKE_TRACE");
+    const char* replay_path = nullptr;
+    const char* batch_path = nullptr;
+    const char* net_path = std::getenv("SNAKE_NET");
+    const char* net_trace_path = nullptr;
+    int stress_position_cnt = 0;
+    int verify_position_cnt = 0;
+    int tournament_game_cnt = 0;
+    int tournament_seat_cnt = TournamentSeats;
+    int move_millisecond_limit = TournamentMoveMillisecondLimit;
+    std::vector<std::string> bots;
+    int thread_cnt = 0;
+    int search_threads = 1;
+    int max_depth = INT_MAX;
+    long long max_nodes = LLONG_MAX;
+    int millisecond_limit = ExecutionMillisecondLimit;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (arg == "--net" && i + 1 < argc) {
+            net_path = argv[++i];
+        } else if (arg == "--train-net" && i + 1 < argc) {
+            net_trace_path = argv[++i];
+        } else if (arg == "--stress" && i + 1 < argc) {
+            stress_position_cnt = std::atoi(argv[++i]);
+        } else if (arg == "--verify-imagine" && i + 1 < argc) {
+            verify_position_cnt = std::atoi(argv[++i]);
+        } else if (arg == "--tournament" && i + 1 < argc) {
+            tournament_game_cnt = std::atoi(argv[++i]);
+        } else if (arg == "--bot" && i + 1 < argc) {
+            bots.push_back(argv[++i]);
+        } else if (arg == "--seats" && i + 1 < argc) {
+            tournament_seat_cnt = std::atoi(argv[++i]);
+        } else if (arg == "--move-limit" && i + 1 < argc) {
+            move_millisecond_limit = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            thread_cnt = std::atoi(argv[++i]);
+        } else if (arg == "--smp" && i + 1 < argc) {
+            search_threads = std::atoi(argv[++i]);
+        } else if (arg == "--depth" && i + 1 < argc) {
+            max_depth = std::atoi(argv[++i]);
+        } else if (arg == "--nodes" && i + 1 < argc) {
+            max_nodes = std::atoll(argv[++i]);
+        } else if (arg == "--millis" && i + 1 < argc) {
+            millisecond_limit = std::atoi(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--record <trace>] [--smp <threads>] [--net <net>] | --replay <trace> | --batch <positions> [--threads <n>]"
+                      << " | --train-net <trace> --net <net> | --stress <positions per snake count>"
+                      << " | --verify-imagine <positions per snake count>"
+                      << " | --tournament <games> --bot <command>... [--seats <n>] [--move-limit <ms>] [--threads <n>]"
+                      << " [--depth <d>] [--nodes <n>] [--millis <ms>]" << std::endl;
+            return 1;
         }
-    } catch (NoTimeRemainException& e) {
-        best_operations_by_depth.pop_back();
-        depth--;
     }
-
-    std::vector<Operation> best_operations = best_operations_by_depth.size() > 0 ? best_operations_by_depth.back() : std::vector<Operation>();
-    Operation best_operation = Shield;
-    if (best_operations.empty()) {
-        std::cerr << "No operation available" << std::endl;
-        best_operation = Shield;
-    } else if (best_operations.size() == 1) {
-        best_operation = best_operations[0];
-    } else {
-        double best_value = VerySmallValue;
-        for (Operation operation : best_operations) {
-            if (!game.CanOperate(game.SelfIdx, operation)) {
-                continue;
-            }
-            int dh, dw;
-            dh = DhOfOperation(operation);
-            dw = DwOfOperation(operation);
-            int head_h, head_w, head_h_next, head_w_next;
-            head_h = game.SnakeInfos[game.SelfIdx].Body.front().h;
-            head_w = game.SnakeInfos[game.SelfIdx].Body.front().w;
-            head_h_next = head_h + dh;
-            head_w_next = head_w + dw;
-            double value = ValueField[head_h_next][head_w_next];
-            if (value >= best_value) {
-                best_value = value;
-                best_operation = operation;
-            }
+    if (search_threads > 1 && max_nodes != LLONG_MAX) {
+        std::cerr << "--nodes is for reproducible searches, which --smp is not" << std::endl;
+        return 1;
+    }
+    if (net_trace_path) {
+        if (!net_path) {
+            std::cerr << "--train-net needs --net <net> to write to" << std::endl;
+            return 1;
         }
+        return TrainNet(net_trace_path, net_path);
+    }
+    static NeuralDanger net;
+    if (net_path && net.Load(net_path)) {
+        LoadedNet = &net;
+    }
+    if (replay_path) {
+        return ReplayTrace(replay_path, max_depth, max_nodes, millisecond_limit);
+    }
+    if (batch_path) {
+        const bool fixed_budget = max_depth != INT_MAX || max_nodes != LLONG_MAX;
+        return RunBatch(batch_path, thread_cnt, max_depth, max_nodes, fixed_budget ? 0 : millisecond_limit);
+    }
+    if (stress_position_cnt > 0) {
+        return RunStress(stress_position_cnt, max_depth, max_nodes, millisecond_limit);
+    }
+    if (verify_position_cnt > 0) {
+        return VerifyImagine(verify_position_cnt);
     }
+    if (tournament_game_cnt > 0) {
+        return RunTournament(bots, tournament_game_cnt, tournament_seat_cnt, thread_cnt, move_millisecond_limit);
+    }
+    if (max_depth != INT_MAX || max_nodes != LLONG_MAX) {
+        // fixed budget instead of the clock: reproducible decisions for comparing builds
+        should_finish_before = std::chrono::system_clock::time_point::max();
+    }
+
+    Game game = Game();
+    static GameSnapshot snapshot;
+    const bool record = record_path && game.Snapshot(snapshot);
+
+    Decision decision = Decide(game, start_time, should_finish_before, max_depth, max_nodes, search_threads);
 
     auto end_time = std::chrono::high_resolution_clock::now();
-    std::cout << best_operation << " "
+    std::cout << decision.Op << " "
               << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count() << "ms"
-              << ", " << depth << " depth"
+              << ", " << decision.Depth << " depth"
               << std::endl;
+    if constexpr (InstrumentEnabled) {
+        ReportInstrumentation(decision.Nodes);
+    }
+
+    // after the answer is out, so recording and logging never eat into the time limit
+    if (record && !AppendTraceRecord(record_path, snapshot, decision)) {
+        Log<LogError>() << "Failed to append trace to " << record_path;
+    }
+    DrainLog();
 }
+#endif  // SNAKE_LIBRARY